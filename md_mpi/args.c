@@ -5,13 +5,17 @@
 #include <getopt.h>
 
 #include "args.h"
+#include "balance.h"
+#include "boundary.h"
 #include "data.h"
+#include "decomp.h"
 #include "vtk.h"
 
 int verbose = 0;
 int no_output = 0;
 int output_freq = 100;
 int enable_checkpoints = 0;
+int binary_output = 0;
 
 static struct option long_options[] = {
 	{"cellx",         required_argument, 0, 'x'},
@@ -27,11 +31,15 @@ static struct option long_options[] = {
 	{"noio",          no_argument,       0, 'n'},
 	{"output",        required_argument, 0, 'o'},
 	{"checkpoint",    no_argument,       0, 'c'},	
+	{"binary",        no_argument,       0, 'B'},
+	{"shared",        no_argument,       0, 'S'},
+	{"balance",       required_argument, 0, 'b'},
+	{"imbalance",     required_argument, 0, 'l'},
     {"verbose",       no_argument,       0, 'v'},
     {"help",          no_argument,       0, 'h'},
 	{0, 0, 0, 0}
 };
-#define GETOPTS "x:y:p:s:r:t:i:d:f:e:no:cvh"
+#define GETOPTS "x:y:p:s:r:t:i:d:f:e:no:cBSb:l:vh"
 
 /**
  * @brief Print a help message
@@ -39,6 +47,11 @@ static struct option long_options[] = {
  * @param progname The name of the current application
  */
 void print_help(char *progname) {
+	// every rank parses the arguments, but only one needs to explain them
+	if (rank != 0) {
+		return;
+	}
+
 	fprintf(stderr, "A simple molecular dynamics simulation using the Lennard-Jones potential and cell lists.\n\n");
 	fprintf(stderr, "Usage: %s [options]\n", progname);
 	fprintf(stderr, "Options and arguments:\n");
@@ -55,6 +68,10 @@ void print_help(char *progname) {
 	fprintf(stderr, "  -n, --noio              Disable file I/O\n");
 	fprintf(stderr, "  -o FILE, --output=FILE  Set base filename for particle output (final output will be in BASENAME.vtp)\n");
 	fprintf(stderr, "  -c, --checkpoint        Enable checkpointing, checkpoints will be in BASENAME-ITERATION.vtp\n");
+	fprintf(stderr, "  -B, --binary            Write binary snapshots (BASENAME.mdp) in parallel with MPI-IO, convert them with tools/mdp2vtp\n");
+	fprintf(stderr, "  -S, --shared            Share the ghost cells' data between the ranks on a node through shared memory\n");
+	fprintf(stderr, "  -b N, --balance=N       Check the load balance every N steps, and move the blocks' edges if needed (default 0, off)\n");
+	fprintf(stderr, "  -l R, --imbalance=R     Rebalance when a rank has more than R times the mean number of particles (default 1.1)\n");
 	fprintf(stderr, "  -v, --verbose           Set verbose output\n");
 	fprintf(stderr, "  -h, --help              Print this message and exit\n");
 	fprintf(stderr, "\n");
@@ -112,6 +129,18 @@ void parse_args(int argc, char *argv[]) {
 			case 'c':
 				enable_checkpoints = 1;
 				break;
+			case 'B':
+				binary_output = 1;
+				break;
+			case 'S':
+				shared_halo = 1;
+				break;
+			case 'b':
+				balance_freq = atoi(optarg);
+				break;
+			case 'l':
+				balance_threshold = atof(optarg);
+				break;
 			case 'v':
 				verbose = 1;
 				break;
@@ -127,6 +156,14 @@ void parse_args(int argc, char *argv[]) {
 		print_help(argv[0]);
 		exit(1);
 	}
+
+	if ((balance_freq < 0) || (balance_threshold < 1.0)) {
+		if (rank == 0) {
+			fprintf(stderr, "Error: The load balancing interval must be at least 0, and the imbalance threshold at least 1.\n");
+		}
+		print_help(argv[0]);
+		exit(1);
+	}
 }
 
 /**
@@ -137,8 +174,8 @@ void print_opts() {
     printf("=======================================\n");
     printf("Started with the following options\n");
     printf("=======================================\n");
-    printf("  cellx            = %14d\n", x);
-	printf("  celly            = %14d\n", y);
+    printf("  cellx            = %14d\n", global_x);
+	printf("  celly            = %14d\n", global_y);
    	printf("  cellsize         = %14.12f\n", cell_size);
 	printf("  cutoff           = %14.12f\n", r_cut_off);
 	printf("  del-t            = %14lf\n", dt);
@@ -148,5 +185,13 @@ void print_opts() {
 	printf("  noio             = %14d\n", no_output);
 	printf("  output           = %s\n", get_basename());
 	printf("  checkpoint       = %14d\n", enable_checkpoints);	
+	printf("  binary           = %14d\n", binary_output);
+	printf("  ranks            = %14d\n", num_ranks);
+	printf("  process grid     = %7d x %4d\n", dims[0], dims[1]);
+	printf("  threads per rank = %14d\n", num_threads);
+	printf("  shared           = %14d\n", shared_halo);
+	printf("  balance          = %14d\n", balance_freq);
+	printf("  imbalance        = %14lf\n", balance_threshold);
+	printf("  total threads    = %14d\n", num_ranks * num_threads);
     printf("=======================================\n");
 }
\ No newline at end of file
@@ -5,6 +5,7 @@ extern int verbose;
 extern int no_output;
 extern int output_freq;
 extern int enable_checkpoints;
+extern int binary_output;
 extern int fixed_dt;
 
 void parse_args(int argc, char *argv[]);
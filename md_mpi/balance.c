@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#include "balance.h"
+#include "boundary.h"
+#include "data.h"
+#include "decomp.h"
+
+// how often (in steps) to check the load balance (0 disables it), and how uneven it has to be to move the splits
+int balance_freq = 0;
+double balance_threshold = 1.1;
+
+// the values sent for each particle that changes rank (position, velocity, id and the global cell it is in)
+#define BALANCE_SIZE 7
+
+/**
+ * @brief Count the particles in this rank's block
+ *
+ * @return int The number of particles
+ */
+int count_local_particles() {
+	int count = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Calculate how unevenly the particles are shared between the ranks (every rank has to call this)
+ *
+ * @return double The most particles on any rank, divided by the mean (1.0 is perfectly balanced)
+ */
+static double imbalance() {
+	int count = count_local_particles();
+	MPI_Allreduce(MPI_IN_PLACE, &count, 1, MPI_INT, MPI_MAX, cart_comm);
+	return count / ((double) num_particles / num_ranks);
+}
+
+/**
+ * @brief Split a line of columns (or rows) into parts with as even a share of the particles as possible, with at
+ *        least one column in each part. Each split is put where the running total is closest to its share.
+ *
+ * @param counts The number of particles in each column
+ * @param n The number of columns
+ * @param parts The number of parts
+ * @param split Set to where each part starts (with split[parts] = n)
+ */
+static void split_evenly(long * counts, int n, int parts, int * split) {
+	long total = 0;
+	for (int c = 0; c < n; c++) {
+		total += counts[c];
+	}
+
+	split[0] = 0;
+	split[parts] = n;
+	long sum = 0;
+	int c = 0;
+	for (int k = 1; k < parts; k++) {
+		double target = (double) total * k / parts;
+
+		// move past the columns that keep the running total below the target, leaving room for the later parts
+		int first = split[k-1] + 1;
+		int last = n - (parts - k);
+		while ((c < first) || ((c < last) && (sum + counts[c] <= target))) {
+			sum += counts[c++];
+		}
+
+		// then take the next column too if that gets closer to the target
+		if ((c < last) && (sum + counts[c] - target < target - sum)) {
+			sum += counts[c++];
+		}
+		split[k] = c;
+	}
+}
+
+/**
+ * @brief Find the rank that owns a cell with the current splits
+ *
+ * @param gi The global x index of the cell (from 1)
+ * @param gj The global y index of the cell (from 1)
+ * @return int The rank
+ */
+static int cell_owner(int gi, int gj) {
+	int c[2] = {0, 0};
+	while (split_x[c[0]+1] < gi) c[0]++;
+	while (split_y[c[1]+1] < gj) c[1]++;
+	int owner;
+	MPI_Cart_rank(cart_comm, c, &owner);
+	return owner;
+}
+
+/**
+ * @brief Balance the load between the ranks, if the particles are shared too unevenly (i.e. the most on any rank
+ *        is more than balance_threshold times the mean). The splits between the blocks are moved so that each
+ *        column of the process grid has as even a share of the particles as possible, and the same for each row
+ *        (as long as that lowers the most particles on any rank), then the cells that now belong to another rank
+ *        are sent there with their particles. Each cell's list keeps the same order, so the forces are summed in
+ *        the same order as before. The particles that leave are kept for reuse by those that arrive (as in
+ *        migrate_particles). Every rank has to call this, between migrate_particles and the force calculation
+ *        (the ghost cells are emptied).
+ *
+ */
+void balance_load() {
+	double current = imbalance();
+	if (current <= balance_threshold) {
+		return;
+	}
+
+	// add up the particles in each column and each row of the whole grid
+	long * line_counts = (long *) calloc(global_x + global_y, sizeof(long));
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				line_counts[offset_x + i - 1]++;
+				line_counts[global_x + offset_y + j - 1]++;
+			}
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, line_counts, global_x + global_y, MPI_LONG, MPI_SUM, cart_comm);
+
+	int * old_split_x = (int *) malloc((dims[0] + 1) * sizeof(int));
+	int * old_split_y = (int *) malloc((dims[1] + 1) * sizeof(int));
+	for (int c = 0; c <= dims[0]; c++) old_split_x[c] = split_x[c];
+	for (int c = 0; c <= dims[1]; c++) old_split_y[c] = split_y[c];
+	split_evenly(line_counts, global_x, dims[0], split_x);
+	split_evenly(&(line_counts[global_x]), global_y, dims[1], split_y);
+	free(line_counts);
+
+	// every rank has the same counts, so they all make the same decision
+	int changed = 0;
+	for (int c = 0; c <= dims[0]; c++) changed |= (split_x[c] != old_split_x[c]);
+	for (int c = 0; c <= dims[1]; c++) changed |= (split_y[c] != old_split_y[c]);
+
+	// each dimension is split on its own, so the new blocks aren't always more even. The particles in each of them
+	// are added up (from the cells of the old ones), and the splits are only used if the most on any rank goes down
+	if (changed) {
+		long * block_counts = (long *) calloc(num_ranks, sizeof(long));
+		for (int i = 1; i < x+1; i++) {
+			for (int j = 1; j < y+1; j++) {
+				int owner = cell_owner(offset_x + i, offset_y + j);
+				for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+					block_counts[owner]++;
+				}
+			}
+		}
+		MPI_Allreduce(MPI_IN_PLACE, block_counts, num_ranks, MPI_LONG, MPI_SUM, cart_comm);
+		long most = 0;
+		for (int r = 0; r < num_ranks; r++) {
+			if (block_counts[r] > most) most = block_counts[r];
+		}
+		free(block_counts);
+		changed = (most / ((double) num_particles / num_ranks) < current);
+	}
+	if (!changed) {
+		for (int c = 0; c <= dims[0]; c++) split_x[c] = old_split_x[c];
+		for (int c = 0; c <= dims[1]; c++) split_y[c] = old_split_y[c];
+		free(old_split_x);
+		free(old_split_y);
+		return;
+	}
+
+	// count the particles going to each rank (all of a cell's particles go to the same one)
+	int * send_counts = (int *) calloc(num_ranks, sizeof(int));
+	int * recv_counts = (int *) malloc(num_ranks * sizeof(int));
+	int * send_displs = (int *) malloc(num_ranks * sizeof(int));
+	int * recv_displs = (int *) malloc(num_ranks * sizeof(int));
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			int owner = cell_owner(offset_x + i, offset_y + j);
+			if (owner == rank) continue;
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				send_counts[owner] += BALANCE_SIZE;
+			}
+		}
+	}
+	MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, cart_comm);
+
+	int num_send = 0;
+	int num_recv = 0;
+	for (int r = 0; r < num_ranks; r++) {
+		send_displs[r] = num_send;
+		recv_displs[r] = num_recv;
+		num_send += send_counts[r];
+		num_recv += recv_counts[r];
+	}
+	double * send_buf = (double *) malloc((num_send + 1) * sizeof(double));
+	double * recv_buf = (double *) malloc((num_recv + 1) * sizeof(double));
+
+	// move the particles that stay into a grid of cells for the new block, and pack up the rest. Each cell is
+	// walked from its tail, since add_particle adds to the head (so the new lists are in the same order)
+	int old_offset_x = offset_x;
+	int old_offset_y = offset_y;
+	int old_x = x;
+	int old_y = y;
+	set_block();
+	struct cell_list ** new_cells = alloc_2d_cell_list_array(x+2, y+2);
+	for (int i = 1; i < old_x+1; i++) {
+		for (int j = 1; j < old_y+1; j++) {
+			int gi = old_offset_x + i;
+			int gj = old_offset_y + j;
+			int owner = cell_owner(gi, gj);
+
+			struct particle_t * p = cells[i][j].head;
+			while ((p != NULL) && (p->next != NULL)) {
+				p = p->next;
+			}
+			while (p != NULL) {
+				struct particle_t * p_prev = p->prev;
+				if (owner == rank) {
+					add_particle(&(new_cells[gi - offset_x][gj - offset_y]), p);
+				} else {
+					double * v = &(send_buf[send_displs[owner]]);
+					v[0] = p->x;
+					v[1] = p->y;
+					v[2] = p->vx;
+					v[3] = p->vy;
+					v[4] = p->part_id;
+					v[5] = gi;
+					v[6] = gj;
+					send_displs[owner] += BALANCE_SIZE;
+					release_particle(p);
+				}
+				p = p_prev;
+			}
+		}
+	}
+	free_2d_array((void **) cells);
+	cells = new_cells;
+
+	// (the displacements were moved along while packing)
+	for (int r = 0; r < num_ranks; r++) {
+		send_displs[r] -= send_counts[r];
+	}
+	MPI_Alltoallv(send_buf, send_counts, send_displs, MPI_DOUBLE, recv_buf, recv_counts, recv_displs, MPI_DOUBLE, cart_comm);
+
+	// each arriving cell's particles were packed from its tail, so adding them in turn restores the order
+	for (int k = 0; k < num_recv; k += BALANCE_SIZE) {
+		double * v = &(recv_buf[k]);
+		struct particle_t * p = take_particle();
+		p->x = v[0];
+		p->y = v[1];
+		p->vx = v[2];
+		p->vy = v[3];
+		p->ax = 0.0;
+		p->ay = 0.0;
+		p->part_id = (int) v[4];
+		add_particle(&(cells[(int) v[5] - offset_x][(int) v[6] - offset_y]), p);
+	}
+
+	free(send_buf);
+	free(recv_buf);
+	free(send_counts);
+	free(recv_counts);
+	free(send_displs);
+	free(recv_displs);
+	free(old_split_x);
+	free(old_split_y);
+}
@@ -0,0 +1,10 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+extern int balance_freq;
+extern double balance_threshold;
+
+int count_local_particles();
+void balance_load();
+
+#endif
@@ -1,23 +1,920 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <mpi.h>
 
 #include "boundary.h"
 #include "data.h"
+#include "decomp.h"
+
+// the copies of the neighbouring ranks' particles that are in the ghost cells
+static struct particle_t * ghost_parts = NULL;
+static int ghost_capacity = 0;
+
+// whether to share the ghost cells' data between the ranks on a node through shared memory windows
+int shared_halo = 0;
+
+// the number of particles in each edge cell sent to (and ghost cell received from) each neighbour. The values for
+// each direction are stored together, starting at cell_displs[d]
+static int * send_counts = NULL;
+static int * recv_counts = NULL;
+static int counts_capacity = 0;
+
+// the messages sent to (and received from) the neighbours, one for each direction, and the positions that didn't
+// fit in them (see start_boundary)
+static double * send_buf = NULL;
+static double * recv_buf = NULL;
+static double * overflow_out = NULL;
+static double * overflow_in = NULL;
+static int send_capacity = 0;
+static int recv_capacity = 0;
+static int overflow_out_capacity = 0;
+static int overflow_in_capacity = 0;
+
+// the number of cells sent in each direction (the same as the number received from the opposite direction, since
+// the blocks in a row or column of the process grid line up), the number of particles sent and received, where
+// they start, and the number of particles there is room for in the message in each direction (which is the same
+// at both ends, since it only depends on what was sent before)
+static int cell_counts[NUM_DIRS];
+static int cell_displs[NUM_DIRS];
+static int num_send[NUM_DIRS];
+static int num_recv[NUM_DIRS];
+static int pos_displs[NUM_DIRS];
+static int recv_displs[NUM_DIRS];
+static int send_room[NUM_DIRS];
+static int recv_room[NUM_DIRS];
+
+// the directions that are sent to (and received from) with messages, and a communicator connecting this rank to
+// those neighbours (without shared memory, that's every direction and halo_comm)
+static MPI_Comm exchange_comm = MPI_COMM_NULL;
+static int send_dirs[NUM_NEIGHBOURS];
+static int recv_dirs[NUM_NEIGHBOURS];
+static int num_send_dirs = 0;
+static int num_recv_dirs = 0;
+
+// the exchange of the messages, and the positions that didn't fit, which are in flight between start_boundary and
+// finish_boundary
+static MPI_Request halo_request = MPI_REQUEST_NULL;
+static MPI_Request overflow_requests[NUM_DIRS];
+
+// the start of each rank's shared memory window, which holds what it sends to its neighbours on the same node (the
+// header, then the counts, then the positions). The steps are numbered by start_boundary, and the flags at the
+// front are how the rank and those neighbours keep out of each other's way
+struct shared_header {
+	volatile int ready; // the last step whose data has been written (or that the window is being grown in)
+	volatile int grow; // the number of bytes the window is being grown to in that step (0 if it isn't)
+	volatile int consumed[NUM_DIRS]; // the last step whose data the neighbour in each direction has finished reading
+	int cells[NUM_DIRS]; // where the counts for each direction start
+	int positions[NUM_DIRS]; // where the positions for each direction start
+	int positions_start; // the number of bytes from the start of the header to the positions
+};
+
+// a shared memory window belonging to this rank or one of its neighbours on the node, over a communicator of just
+// the owner and its neighbours on the node (which are the ranks that read it)
+struct shared_window {
+	int owner; // the owner's rank in node_comm
+	int root; // and in comm
+	MPI_Comm comm;
+	MPI_Win win;
+	char * base; // the owner's memory
+	int capacity; // its size in bytes
+};
+
+// the ranks on this node (and this rank's rank among them), the windows this rank shares (its own and those of its
+// neighbours on the node, in order of owner), which of them holds the data sent in each direction (or -1 if the
+// neighbour that sends it is on another node), the directions this rank's own window is read in, and the step
+static MPI_Comm node_comm = MPI_COMM_NULL;
+static int node_rank = 0;
+static struct shared_window windows[NUM_DIRS];
+static int num_windows = 0;
+static struct shared_window * own_window = NULL;
+static int source_window[NUM_DIRS];
+static int shared_destination[NUM_DIRS];
+static int halo_step = 0;
+
+// the values sent for each migrating particle (position, velocity, id and the ghost cell it is in)
+#define MIGRATE_SIZE 7
+
+// a buffer of packed migrating particles
+struct migration_buffer {
+	double * data;
+	int count; // the number of values (i.e. MIGRATE_SIZE for each particle)
+	int capacity;
+};
+
+// the particles leaving for each neighbour (packed as they leave, and sent straight from there), and the ones
+// arriving from the neighbours
+static struct migration_buffer outgoing[NUM_DIRS];
+static struct migration_buffer incoming;
+
+// particles that have left this rank, whose memory can be reused by the particles that arrive
+static struct particle_t * spare = NULL;
+
+/**
+ * @brief Get the range of cells at the edge of this rank's block next to a neighbour (i.e. the cells
+ *        it needs as ghost cells)
+ *
+ * @param d The direction of the neighbour
+ * @param i0 Set to the first column
+ * @param i1 Set to the last column
+ * @param j0 Set to the first row
+ * @param j1 Set to the last row
+ */
+static void edge_cells(int d, int * i0, int * i1, int * j0, int * j1) {
+	*i0 = (DIR_X(d) == 1) ? x : 1;
+	*i1 = (DIR_X(d) == -1) ? 1 : x;
+	*j0 = (DIR_Y(d) == 1) ? y : 1;
+	*j1 = (DIR_Y(d) == -1) ? 1 : y;
+}
+
+/**
+ * @brief Get the range of ghost cells that hold the particles of a neighbour
+ *
+ * @param d The direction of the neighbour
+ * @param i0 Set to the first column
+ * @param i1 Set to the last column
+ * @param j0 Set to the first row
+ * @param j1 Set to the last row
+ */
+static void ghost_cells(int d, int * i0, int * i1, int * j0, int * j1) {
+	*i0 = (DIR_X(d) == -1) ? 0 : (DIR_X(d) == 1) ? x+1 : 1;
+	*i1 = (DIR_X(d) == -1) ? 0 : (DIR_X(d) == 1) ? x+1 : x;
+	*j0 = (DIR_Y(d) == -1) ? 0 : (DIR_Y(d) == 1) ? y+1 : 1;
+	*j1 = (DIR_Y(d) == -1) ? 0 : (DIR_Y(d) == 1) ? y+1 : y;
+}
+
+/**
+ * @brief Make sure a buffer of doubles can hold a number of values
+ *
+ * @param buf The buffer
+ * @param capacity The number of values it can hold
+ * @param n The number of values needed
+ */
+static void reserve_buffer(double ** buf, int * capacity, int n) {
+	if (n > *capacity) {
+		*capacity = n + n / 4;
+		free(*buf);
+		*buf = (double *) malloc(*capacity * sizeof(double));
+	}
+}
+
+/**
+ * @brief Make sure a migration buffer can hold a number of values (growing it by at least half, so this is rare)
+ *
+ * @param buf The buffer
+ * @param n The number of values needed
+ */
+static void reserve_migration(struct migration_buffer * buf, int n) {
+	if (n > buf->capacity) {
+		buf->capacity = (n > 2 * buf->capacity) ? n : 2 * buf->capacity;
+		buf->data = (double *) realloc(buf->data, buf->capacity * sizeof(double));
+	}
+}
+
+/**
+ * @brief Empty the ghost cells (the copies they hold are reused, so nothing is freed)
+ *
+ */
+static void clear_ghost_cells() {
+	for (int j = 0; j < y+2; j++) {
+		cells[0][j].head = NULL;
+		cells[x+1][j].head = NULL;
+	}
+	for (int i = 1; i < x+1; i++) {
+		cells[i][0].head = NULL;
+		cells[i][y+1].head = NULL;
+	}
+}
+
+/**
+ * @brief Find the ranks that share a rank's shared memory window, i.e. the rank itself and its neighbours on this
+ *        node
+ *
+ * @param owner The rank (in node_comm)
+ * @param members Set to the ranks (in node_comm, in order)
+ * @param cart_group The group of cart_comm
+ * @param node_group The group of node_comm
+ * @return int The number of ranks
+ */
+static int window_members(int owner, int * members, MPI_Group cart_group, MPI_Group node_group) {
+	int owner_cart;
+	int owner_coords[2];
+	MPI_Group_translate_ranks(node_group, 1, &owner, cart_group, &owner_cart);
+	MPI_Cart_coords(cart_comm, owner_cart, 2, owner_coords);
+
+	int around[NUM_DIRS];
+	int node_around[NUM_DIRS];
+	for (int d = 0; d < NUM_DIRS; d++) {
+		int c[2] = {owner_coords[0] + DIR_X(d), owner_coords[1] + DIR_Y(d)};
+		MPI_Cart_rank(cart_comm, c, &(around[d]));
+	}
+	MPI_Group_translate_ranks(cart_group, NUM_DIRS, around, node_group, node_around);
+
+	// insert each in order, skipping those on other nodes (and repeats, on small grids)
+	int n = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		int r = node_around[d];
+		int k = n;
+		if (r == MPI_UNDEFINED) continue;
+		while ((k > 0) && (members[k-1] > r)) k--;
+		if ((k > 0) && (members[k-1] == r)) continue;
+		for (int m = n; m > k; m--) {
+			members[m] = members[m-1];
+		}
+		members[k] = r;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @brief Allocate the memory of a shared memory window (only the owner's part has any), and find the owner's
+ *        part. Every rank that shares the window has to call this.
+ *
+ * @param w The window
+ * @param size The number of bytes the owner needs
+ */
+static void allocate_window(struct shared_window * w, int size) {
+	char * base;
+	MPI_Win_allocate_shared((w->owner == node_rank) ? size : 0, 1, MPI_INFO_NULL, w->comm, &base, &(w->win));
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, w->win);
+
+	MPI_Aint capacity;
+	int disp_unit;
+	MPI_Win_shared_query(w->win, w->root, &capacity, &disp_unit, &(w->base));
+	w->capacity = (int) capacity;
+}
+
+/**
+ * @brief Reset the flags at the front of this rank's window, as if its data for a step had been read (but not
+ *        yet written). The other ranks that share the window have to wait until this has been done.
+ *
+ * @param step The step
+ */
+static void reset_window(int step) {
+	struct shared_header * header = (struct shared_header *) own_window->base;
+	header->ready = step - 1;
+	header->grow = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		header->consumed[d] = step - 1;
+	}
+}
+
+/**
+ * @brief Set up the exchanges for the ghost cells. With shared_halo, the ranks on the same node are found, and
+ *        only the neighbours on other nodes are sent messages (with a communicator connecting just those); the
+ *        data for the others is read straight from their shared memory windows. Each rank has its own window,
+ *        shared with just its neighbours on the node, which starts with room for only the header (so it is grown
+ *        on the first step).
+ *
+ */
+void setup_boundary() {
+	for (int d = 0; d < NUM_DIRS; d++) {
+		source_window[d] = -1;
+		shared_destination[d] = 0;
+		send_room[d] = recv_room[d] = 0;
+		overflow_requests[d] = MPI_REQUEST_NULL;
+	}
+
+	if (!shared_halo) {
+		exchange_comm = halo_comm;
+		num_send_dirs = num_recv_dirs = 0;
+		for (int d = 0; d < NUM_DIRS; d++) {
+			if (d == DIR_SELF) continue;
+			send_dirs[num_send_dirs++] = d;
+			recv_dirs[num_recv_dirs++] = d;
+		}
+		return;
+	}
+
+	// find which neighbours are on this node (and their rank within it)
+	MPI_Comm_split_type(cart_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+	MPI_Comm_rank(node_comm, &node_rank);
+	MPI_Group cart_group;
+	MPI_Group node_group;
+	MPI_Comm_group(cart_comm, &cart_group);
+	MPI_Comm_group(node_comm, &node_group);
+	int sources[NUM_DIRS];
+	int destinations[NUM_DIRS];
+	int node_source[NUM_DIRS];
+	int node_destination[NUM_DIRS];
+	for (int d = 0; d < NUM_DIRS; d++) {
+		sources[d] = neighbour[DIR_OPPOSITE(d)];
+		destinations[d] = neighbour[d];
+	}
+	MPI_Group_translate_ranks(cart_group, NUM_DIRS, sources, node_group, node_source);
+	MPI_Group_translate_ranks(cart_group, NUM_DIRS, destinations, node_group, node_destination);
+
+	// this rank shares its own window and those of the neighbours on this node that send to it (which are also
+	// the ones it sends to). Every rank sets them up in order of owner, so no two ranks wait for each other
+	int owners[NUM_DIRS];
+	num_windows = window_members(node_rank, owners, cart_group, node_group);
+	for (int w = 0; w < num_windows; w++) {
+		struct shared_window * window = &(windows[w]);
+		int members[NUM_DIRS];
+		int num_members = window_members(owners[w], members, cart_group, node_group);
+		MPI_Group group;
+		MPI_Group_incl(node_group, num_members, members, &group);
+		MPI_Comm_create_group(node_comm, group, owners[w], &(window->comm));
+		MPI_Group_free(&group);
+
+		window->owner = owners[w];
+		for (int k = 0; k < num_members; k++) {
+			if (members[k] == owners[w]) window->root = k;
+		}
+		if (owners[w] == node_rank) {
+			own_window = window;
+		}
+		allocate_window(window, sizeof(struct shared_header));
+		if (window == own_window) {
+			reset_window(1);
+		}
+		MPI_Win_sync(window->win);
+		MPI_Barrier(window->comm);
+		MPI_Win_sync(window->win);
+
+		for (int d = 0; d < NUM_DIRS; d++) {
+			if ((d != DIR_SELF) && (node_source[d] == owners[w])) source_window[d] = w;
+		}
+	}
+	MPI_Group_free(&cart_group);
+	MPI_Group_free(&node_group);
+
+	// connect this rank to the rest (in direction order at both ends, and weighted, as for halo_comm)
+	int graph_sources[NUM_NEIGHBOURS];
+	int graph_destinations[NUM_NEIGHBOURS];
+	int source_weights[NUM_NEIGHBOURS];
+	int destination_weights[NUM_NEIGHBOURS];
+	num_send_dirs = num_recv_dirs = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		int weight = (DIR_X(d) == 0) ? x : (DIR_Y(d) == 0) ? y : 1;
+		if (node_destination[d] == MPI_UNDEFINED) {
+			graph_destinations[num_send_dirs] = neighbour[d];
+			destination_weights[num_send_dirs] = weight;
+			send_dirs[num_send_dirs++] = d;
+		} else {
+			shared_destination[d] = 1;
+		}
+		if (node_source[d] == MPI_UNDEFINED) {
+			graph_sources[num_recv_dirs] = neighbour[DIR_OPPOSITE(d)];
+			source_weights[num_recv_dirs] = weight;
+			recv_dirs[num_recv_dirs++] = d;
+		}
+	}
+	MPI_Dist_graph_create_adjacent(cart_comm, num_recv_dirs, graph_sources, source_weights, num_send_dirs,
+	                               graph_destinations, destination_weights, MPI_INFO_NULL, 0, &exchange_comm);
+}
+
+/**
+ * @brief Wait for a flag in a shared memory window to reach a step (giving up the processor in between, in case
+ *        the node is oversubscribed)
+ *
+ * @param flag The flag
+ * @param step The step
+ * @param win The window
+ */
+static void wait_for_step(volatile int * flag, int step, MPI_Win win) {
+	MPI_Win_sync(win);
+	while (*flag < step) {
+		sched_yield();
+		MPI_Win_sync(win);
+	}
+
+	// (so whatever is read next is read after the flag)
+	MPI_Win_sync(win);
+}
+
+/**
+ * @brief Wait until every neighbour on this node has written its data for a step into its window
+ *
+ * @param step The step
+ */
+static void wait_for_sources(int step) {
+	for (int w = 0; w < num_windows; w++) {
+		struct shared_header * header = (struct shared_header *) windows[w].base;
+		wait_for_step(&(header->ready), step, windows[w].win);
+	}
+}
+
+/**
+ * @brief Replace a shared memory window that has become too small with a larger one (whose size the owner has put
+ *        in the header). Only the ranks that share the window take part, and the others wait for the owner to
+ *        write its data into the new one in the usual way.
+ *
+ * @param w The window
+ * @param step The step the window is being grown in
+ */
+static void grow_window(struct shared_window * w, int step) {
+	int size = ((struct shared_header *) w->base)->grow;
+	MPI_Win_unlock_all(w->win);
+	MPI_Win_free(&(w->win));
+	allocate_window(w, size);
+	if (w == own_window) {
+		reset_window(step);
+	}
+	MPI_Win_sync(w->win);
+	MPI_Barrier(w->comm);
+	MPI_Win_sync(w->win);
+}
+
+/**
+ * @brief Pack the positions of the particles in the cells at the edge of this rank's block next to a neighbour, in
+ *        the order the counts were made in
+ *
+ * @param d The direction of the neighbour
+ * @param positions Where to put them
+ * @param room The number of particles there is room for there
+ * @param overflow Where to put the rest
+ */
+static void pack_edge(int d, double * positions, int room, double * overflow) {
+	int i0, i1, j0, j1;
+	edge_cells(d, &i0, &i1, &j0, &j1);
+	int n = 0;
+	for (int i = i0; i <= i1; i++) {
+		for (int j = j0; j <= j1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				double * v = (n < 2 * room) ? &(positions[n]) : &(overflow[n - 2 * room]);
+				v[0] = p->x;
+				v[1] = p->y;
+				n += 2;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Pack the positions of the particles in the cells at the edges of this rank's block, for every direction in
+ *        turn (starting at pos_displs[d])
+ *
+ * @param positions Where to put them
+ */
+static void pack_positions(double * positions) {
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		pack_edge(d, &(positions[pos_displs[d]]), num_send[d], NULL);
+	}
+}
+
+/**
+ * @brief Find where the positions start in this rank's window (after the header and the counts)
+ *
+ * @param num_cells The number of counts
+ * @return int The number of bytes from the start of the window
+ */
+static int window_positions(int num_cells) {
+	int start = sizeof(struct shared_header) + num_cells * sizeof(int);
+	return (start + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+}
+
+/**
+ * @brief Write this rank's data for a step into its window (the header, then the counts, then the positions), and
+ *        mark it as ready to be read
+ *
+ * @param step The step
+ */
+static void write_window(int step) {
+	int num_cells = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		num_cells += cell_counts[d];
+	}
+
+	struct shared_header * header = (struct shared_header *) own_window->base;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		header->cells[d] = cell_displs[d];
+		header->positions[d] = pos_displs[d];
+	}
+	header->positions_start = window_positions(num_cells);
+	int * counts = (int *) (own_window->base + sizeof(struct shared_header));
+	for (int k = 0; k < num_cells; k++) {
+		counts[k] = send_counts[k];
+	}
+	pack_positions((double *) (own_window->base + header->positions_start));
+
+	header->grow = 0;
+	MPI_Win_sync(own_window->win);
+	header->ready = step;
+}
+
+/**
+ * @brief Read the data from the neighbours on this node for a step, once they have written it into their windows.
+ *        Any windows that were too small are grown first, in order of owner (so no two ranks wait for each other),
+ *        and this rank writes its own data if its window was one of them.
+ *
+ * @param step The step
+ */
+static void read_windows(int step) {
+	wait_for_sources(step);
+	int grown = 0;
+	for (int w = 0; w < num_windows; w++) {
+		if (((struct shared_header *) windows[w].base)->grow > 0) {
+			grow_window(&(windows[w]), step);
+			grown = 1;
+		}
+	}
+	if (grown) {
+		if (((struct shared_header *) own_window->base)->ready < step) {
+			write_window(step);
+		}
+		wait_for_sources(step);
+	}
+
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if ((d == DIR_SELF) || (source_window[d] < 0)) continue;
+		char * base = windows[source_window[d]].base;
+		struct shared_header * source = (struct shared_header *) base;
+		int * counts = (int *) (base + sizeof(struct shared_header));
+		num_recv[d] = 0;
+		for (int k = 0; k < cell_counts[d]; k++) {
+			recv_counts[cell_displs[d] + k] = counts[source->cells[d] + k];
+			num_recv[d] += counts[source->cells[d] + k];
+		}
+	}
+}
+
+/**
+ * @brief Start applying the boundary conditions, by sending copies of the particles in the cells at the edges of
+ *        this rank's block to the neighbouring ranks, which hold them in their ghost cells. The ranks are arranged
+ *        periodically, so at the edges of the domain this wraps around to the other side (which may be this rank).
+ *        The number of particles in each edge cell and their positions are sent together, with one non-blocking
+ *        neighbourhood collective, so the cells that don't need the ghost cells can be worked on while they are
+ *        on their way; finish_boundary completes the exchange. With shared_halo, this rank's data is written into
+ *        its shared memory window instead (once its neighbours on this node have finished reading the last
+ *        step's), they read it from there (in finish_boundary) once it is marked as ready, and only the others are
+ *        sent it. This has to be done after every step (after migrate_particles), since the particles have moved.
+ *
+ */
+void start_boundary() {
+	clear_ghost_cells();
+
+	// lay out the counts for each direction, and count the particles in each edge cell
+	int num_cells = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		int i0, i1, j0, j1;
+		edge_cells(d, &i0, &i1, &j0, &j1);
+		cell_counts[d] = (i1 - i0 + 1) * (j1 - j0 + 1);
+		cell_displs[d] = num_cells;
+		num_cells += cell_counts[d];
+	}
+	if (num_cells > counts_capacity) {
+		counts_capacity = num_cells;
+		send_counts = (int *) realloc(send_counts, counts_capacity * sizeof(int));
+		recv_counts = (int *) realloc(recv_counts, counts_capacity * sizeof(int));
+	}
+
+	int total = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		int i0, i1, j0, j1;
+		edge_cells(d, &i0, &i1, &j0, &j1);
+		int n = cell_displs[d];
+		num_send[d] = 0;
+		for (int i = i0; i <= i1; i++) {
+			for (int j = j0; j <= j1; j++) {
+				int count = 0;
+				for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+					count++;
+				}
+				send_counts[n++] = count;
+				num_send[d] += count;
+			}
+		}
+		pos_displs[d] = 2 * total;
+		total += num_send[d];
+	}
+
+	// with shared_halo, this rank's data is written into its window (the header, the counts, then the positions),
+	// once the neighbours on this node have read the last step's. If it doesn't fit, the size needed is passed to
+	// them instead, and the window is grown in finish_boundary (where their data is read)
+	if (shared_halo) {
+		int step = ++halo_step;
+		int size = window_positions(num_cells) + 2 * total * sizeof(double);
+		struct shared_header * header = (struct shared_header *) own_window->base;
+		for (int d = 0; d < NUM_DIRS; d++) {
+			if (shared_destination[d]) wait_for_step(&(header->consumed[d]), step - 1, own_window->win);
+		}
+		if (size <= own_window->capacity) {
+			write_window(step);
+		} else {
+			header->grow = size + size / 4;
+			MPI_Win_sync(own_window->win);
+			header->ready = step;
+		}
+	}
+
+	// each neighbour on another node is sent a single message, with the number of particles, the count for each
+	// cell, then the positions. There is room in it for as many particles as were ever sent in that direction (with
+	// some to spare), which the neighbour knows too, so it can be received without waiting for the counts. The
+	// positions that don't fit follow in a separate message (which is rare), and the room is grown
+	int sizes[NUM_NEIGHBOURS];
+	int displs[NUM_NEIGHBOURS];
+	int recv_sizes[NUM_NEIGHBOURS];
+	int recv_starts[NUM_NEIGHBOURS];
+	int num_send_values = 0;
+	int num_overflow = 0;
+	for (int k = 0; k < num_send_dirs; k++) {
+		int d = send_dirs[k];
+		sizes[k] = 1 + cell_counts[d] + 2 * send_room[d];
+		displs[k] = num_send_values;
+		num_send_values += sizes[k];
+		if (num_send[d] > send_room[d]) {
+			num_overflow += 2 * (num_send[d] - send_room[d]);
+		}
+	}
+	reserve_buffer(&send_buf, &send_capacity, num_send_values);
+	reserve_buffer(&overflow_out, &overflow_out_capacity, num_overflow);
+
+	num_overflow = 0;
+	for (int k = 0; k < num_send_dirs; k++) {
+		int d = send_dirs[k];
+		double * v = &(send_buf[displs[k]]);
+		v[0] = num_send[d];
+		for (int c = 0; c < cell_counts[d]; c++) {
+			v[1 + c] = send_counts[cell_displs[d] + c];
+		}
+		pack_edge(d, &(v[1 + cell_counts[d]]), send_room[d], &(overflow_out[num_overflow]));
+		if (num_send[d] > send_room[d]) {
+			int n = 2 * (num_send[d] - send_room[d]);
+			MPI_Isend(&(overflow_out[num_overflow]), n, MPI_DOUBLE, neighbour[d], d, cart_comm, &(overflow_requests[d]));
+			num_overflow += n;
+			send_room[d] = num_send[d] + num_send[d] / 4;
+		}
+	}
+
+	int num_recv_values = 0;
+	for (int k = 0; k < num_recv_dirs; k++) {
+		int d = recv_dirs[k];
+		recv_sizes[k] = 1 + cell_counts[d] + 2 * recv_room[d];
+		recv_starts[k] = recv_displs[d] = num_recv_values;
+		num_recv_values += recv_sizes[k];
+	}
+	reserve_buffer(&recv_buf, &recv_capacity, num_recv_values);
+
+	MPI_Ineighbor_alltoallv(send_buf, sizes, displs, MPI_DOUBLE,
+	                        recv_buf, recv_sizes, recv_starts, MPI_DOUBLE, exchange_comm, &halo_request);
+}
+
+/**
+ * @brief Finish applying the boundary conditions (started by start_boundary). Once the positions have arrived,
+ *        the copies are stored together and linked into the ghost cells in the same order as the originals.
+ *        With shared_halo, the data from the neighbours on this node is read from their windows (which are grown
+ *        first, if they were too small), and they are then told that this rank has finished reading.
+ *
+ */
+void finish_boundary() {
+	if (shared_halo) {
+		read_windows(halo_step);
+	}
+	MPI_Wait(&halo_request, MPI_STATUS_IGNORE);
+
+	// read the counts from the messages (those from the neighbours on this node have been read already)
+	int total = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		if (source_window[d] < 0) {
+			double * v = &(recv_buf[recv_displs[d]]);
+			num_recv[d] = (int) v[0];
+			for (int c = 0; c < cell_counts[d]; c++) {
+				recv_counts[cell_displs[d] + c] = (int) v[1 + c];
+			}
+		}
+		total += num_recv[d];
+	}
+	if (total > ghost_capacity) {
+		ghost_capacity = total + total / 4;
+		free(ghost_parts);
+		ghost_parts = (struct particle_t *) malloc(ghost_capacity * sizeof(struct particle_t));
+	}
+
+	// link the copies into the ghost cells
+	int next = 0;
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+
+		// the positions either arrived in a message (with the rest in a second one, if they didn't fit), or are in
+		// the neighbour's window
+		double * positions = &(recv_buf[recv_displs[d] + 1 + cell_counts[d]]);
+		if (source_window[d] >= 0) {
+			char * base = windows[source_window[d]].base;
+			struct shared_header * header = (struct shared_header *) base;
+			positions = (double *) (base + header->positions_start) + header->positions[d];
+		} else if (num_recv[d] > recv_room[d]) {
+			reserve_buffer(&overflow_in, &overflow_in_capacity, 2 * num_recv[d]);
+			for (int k = 0; k < 2 * recv_room[d]; k++) {
+				overflow_in[k] = positions[k];
+			}
+			MPI_Recv(&(overflow_in[2 * recv_room[d]]), 2 * (num_recv[d] - recv_room[d]), MPI_DOUBLE,
+			         neighbour[DIR_OPPOSITE(d)], d, cart_comm, MPI_STATUS_IGNORE);
+			positions = overflow_in;
+			recv_room[d] = num_recv[d] + num_recv[d] / 4;
+		}
+
+		// the particles came from the neighbour in the opposite direction
+		int i0, i1, j0, j1;
+		ghost_cells(DIR_OPPOSITE(d), &i0, &i1, &j0, &j1);
+		int c = cell_displs[d];
+		int n = 0;
+		for (int i = i0; i <= i1; i++) {
+			for (int j = j0; j <= j1; j++) {
+				struct particle_t * prev = NULL;
+				for (int k = 0; k < recv_counts[c]; k++) {
+					struct particle_t * p = &(ghost_parts[next++]);
+					p->x = positions[n++];
+					p->y = positions[n++];
+					p->prev = prev;
+					p->next = NULL;
+					if (prev == NULL) {
+						cells[i][j].head = p;
+					} else {
+						prev->next = p;
+					}
+					prev = p;
+				}
+				c++;
+			}
+		}
+	}
+
+	MPI_Waitall(NUM_DIRS, overflow_requests, MPI_STATUSES_IGNORE);
+
+	// let the neighbours on this node know their windows can be written again
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if ((d == DIR_SELF) || (source_window[d] < 0)) continue;
+		struct shared_window * w = &(windows[source_window[d]]);
+		MPI_Win_sync(w->win);
+		((struct shared_header *) w->base)->consumed[d] = halo_step;
+	}
+}
+
+/**
+ * @brief Get the memory for a particle that has arrived on this rank, reusing a particle that has left if there
+ *        is one
+ *
+ * @return struct particle_t* The particle
+ */
+struct particle_t * take_particle() {
+	struct particle_t * p = spare;
+	if (p != NULL) {
+		spare = p->next;
+	} else {
+		p = (struct particle_t *) malloc(sizeof(struct particle_t));
+	}
+	return p;
+}
+
+/**
+ * @brief Keep the memory of a particle that has left this rank, for reuse by a particle that arrives
+ *
+ * @param p The particle (which has already been removed from its cell)
+ */
+void release_particle(struct particle_t * p) {
+	p->next = spare;
+	spare = p;
+}
+
+/**
+ * @brief Pack up a particle that has left this rank's block, to be sent to the neighbour that owns the cell it has
+ *        moved into. The particle's memory is kept for reuse by the particles that arrive.
+ *
+ * @param p The particle (which has already been removed from its cell)
+ * @param i The x index of the cell it has moved into (i.e. a ghost cell)
+ * @param j The y index of the cell it has moved into
+ */
+void depart_particle(struct particle_t * p, int i, int j) {
+	int dx = (i < 1) ? -1 : (i > x) ? 1 : 0;
+	int dy = (j < 1) ? -1 : (j > y) ? 1 : 0;
+	struct migration_buffer * out = &(outgoing[DIR_INDEX(dx, dy)]);
+
+	reserve_migration(out, out->count + MIGRATE_SIZE);
+	double * v = &(out->data[out->count]);
+	v[0] = p->x;
+	v[1] = p->y;
+	v[2] = p->vx;
+	v[3] = p->vy;
+	v[4] = p->part_id;
+	v[5] = i;
+	v[6] = j;
+	out->count += MIGRATE_SIZE;
+
+	release_particle(p);
+}
+
+/**
+ * @brief Send the particles that have left this rank's block (packed by depart_particle) to the ranks that now
+ *        own them, and add the ones that have arrived. A particle that crossed the left edge goes to the neighbour
+ *        on the left, where it is added to the last column (and so on). The number of values for each neighbour is
+ *        exchanged first, then the particles themselves, each with a single neighbourhood collective (the particles
+ *        with MPI_Neighbor_alltoallw, which can send each neighbour's from its own buffer). The buffers are kept
+ *        (and only grown) between steps.
+ *
+ */
+void migrate_particles() {
+	int send_sizes[NUM_NEIGHBOURS];
+	MPI_Aint send_displs[NUM_NEIGHBOURS];
+	MPI_Datatype send_types[NUM_NEIGHBOURS];
+	int recv_sizes[NUM_NEIGHBOURS];
+	MPI_Aint recv_displs[NUM_NEIGHBOURS];
+	MPI_Datatype recv_types[NUM_NEIGHBOURS];
+
+	// each neighbour's particles are sent from the buffer they were packed into (by its address, so there is no
+	// need to copy them all into one buffer first)
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		send_sizes[NEIGHBOUR_INDEX(d)] = outgoing[d].count;
+		send_types[NEIGHBOUR_INDEX(d)] = MPI_DOUBLE;
+		send_displs[NEIGHBOUR_INDEX(d)] = 0;
+		if (outgoing[d].count > 0) {
+			MPI_Get_address(outgoing[d].data, &(send_displs[NEIGHBOUR_INDEX(d)]));
+		}
+	}
+
+	MPI_Neighbor_alltoall(send_sizes, 1, MPI_INT, recv_sizes, 1, MPI_INT, halo_comm);
+	int n = 0;
+	for (int k = 0; k < NUM_NEIGHBOURS; k++) {
+		recv_displs[k] = n * sizeof(double);
+		recv_types[k] = MPI_DOUBLE;
+		n += recv_sizes[k];
+	}
+	reserve_migration(&incoming, n);
+	MPI_Neighbor_alltoallw(MPI_BOTTOM, send_sizes, send_displs, send_types,
+	                       incoming.data, recv_sizes, recv_displs, recv_types, halo_comm);
+
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+
+		// the particles sent in direction d come from the neighbour in the opposite direction, so they crossed
+		// that edge of this block
+		int from_x = DIR_X(DIR_OPPOSITE(d));
+		int from_y = DIR_Y(DIR_OPPOSITE(d));
+		int first = recv_displs[NEIGHBOUR_INDEX(d)] / sizeof(double);
+		for (int k = first; k < first + recv_sizes[NEIGHBOUR_INDEX(d)]; k += MIGRATE_SIZE) {
+			double * v = &(incoming.data[k]);
+			struct particle_t * p = take_particle();
+			p->x = v[0];
+			p->y = v[1];
+			p->vx = v[2];
+			p->vy = v[3];
+			p->ax = 0.0;
+			p->ay = 0.0;
+			p->part_id = (int) v[4];
+			int i = (from_x == 1) ? x : (from_x == -1) ? 1 : (int) v[5];
+			int j = (from_y == 1) ? y : (from_y == -1) ? 1 : (int) v[6];
+			add_particle(&(cells[i][j]), p);
+		}
+	}
+
+	for (int d = 0; d < NUM_DIRS; d++) {
+		outgoing[d].count = 0;
+	}
+}
 
 /**
- * @brief Apply the boundary conditions. This effectively points the ghost cell areas
- *        to the same cell list as the opposite edge (i.e. wraps the domain).
- *        This has to be done after every cell list update, just to ensure that a destructive
- *        operations hasn't broken things.
- * 
+ * @brief Free the ghost copies, the exchange and migration buffers (and the shared memory windows), and the spare
+ *        particles
+ *
  */
-void apply_boundary() {
-	// Apply boundary conditions
-	for (int j = 1; j < y+1; j++) {
-		cells[0][j].head = cells[x][j].head;
-		cells[x+1][j].head = cells[1][j].head;
+void free_boundary() {
+	free(ghost_parts);
+	free(send_buf);
+	free(recv_buf);
+	free(overflow_out);
+	free(overflow_in);
+	free(send_counts);
+	free(recv_counts);
+	ghost_parts = NULL;
+	send_buf = recv_buf = overflow_out = overflow_in = NULL;
+	send_counts = recv_counts = NULL;
+	ghost_capacity = send_capacity = recv_capacity = counts_capacity = 0;
+	overflow_out_capacity = overflow_in_capacity = 0;
+
+	// (in order of owner, as they were set up)
+	for (int w = 0; w < num_windows; w++) {
+		MPI_Win_unlock_all(windows[w].win);
+		MPI_Win_free(&(windows[w].win));
+		MPI_Comm_free(&(windows[w].comm));
+	}
+	num_windows = 0;
+	own_window = NULL;
+	if (node_comm != MPI_COMM_NULL) {
+		MPI_Comm_free(&exchange_comm);
+		MPI_Comm_free(&node_comm);
+	}
+	exchange_comm = MPI_COMM_NULL;
+
+	for (int d = 0; d < NUM_DIRS; d++) {
+		free(outgoing[d].data);
+		outgoing[d].data = NULL;
+		outgoing[d].count = outgoing[d].capacity = 0;
 	}
+	free(incoming.data);
+	incoming.data = NULL;
+	incoming.count = incoming.capacity = 0;
 
-	for (int i = 0; i < x+2; i++) {
-		cells[i][0].head = cells[i][y].head;
-		cells[i][y+1].head = cells[i][1].head;
+	while (spare != NULL) {
+		struct particle_t * p = spare;
+		spare = p->next;
+		free(p);
 	}
-}
\ No newline at end of file
+}
@@ -1,6 +1,17 @@
 #ifndef BOUNDARY_H
 #define BOUNDARY_H
 
-void apply_boundary();
+#include "data.h"
+
+extern int shared_halo;
+
+void setup_boundary();
+void start_boundary();
+void finish_boundary();
+struct particle_t * take_particle();
+void release_particle(struct particle_t * p);
+void depart_particle(struct particle_t * p, int i, int j);
+void migrate_particles();
+void free_boundary();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#include "data.h"
+#include "decomp.h"
+
+// this process, the number of processes and the (periodic) Cartesian process grid they are arranged in
+int rank = 0;
+int num_ranks = 1;
+MPI_Comm cart_comm = MPI_COMM_NULL;
+int dims[2];
+int coords[2];
+
+// the number of OpenMP threads each rank runs (1 unless this is the hybrid build)
+int num_threads = 1;
+
+// the rank that owns each neighbouring block
+int neighbour[NUM_DIRS];
+
+// a communicator connecting each rank to its eight neighbours, for the neighbourhood collectives
+MPI_Comm halo_comm = MPI_COMM_NULL;
+
+// the size of the whole grid of cells, and where this rank's block starts in it (x and y are the size of the block)
+int global_x;
+int global_y;
+int offset_x;
+int offset_y;
+
+// where the blocks start in each dimension (the columns split_x[c]+1 to split_x[c+1] belong to the ranks with x
+// coordinate c, and the same for the rows), so the blocks can be resized by moving the splits
+int * split_x = NULL;
+int * split_y = NULL;
+
+/**
+ * @brief Split the grid of cells into a block for each rank. The ranks are arranged in a periodic 2D Cartesian grid
+ *        (with more ranks along the longer side of the domain), and each is given an even share of the columns and
+ *        rows. Afterwards, x and y are the size of this rank's block, and global_x and global_y the size of the grid.
+ *
+ */
+void decompose() {
+	global_x = x;
+	global_y = y;
+
+	dims[0] = 0;
+	dims[1] = 0;
+	MPI_Dims_create(num_ranks, 2, dims);
+	if (global_y > global_x) {
+		int tmp = dims[0];
+		dims[0] = dims[1];
+		dims[1] = tmp;
+	}
+
+	if ((dims[0] > global_x) || (dims[1] > global_y)) {
+		if (rank == 0) {
+			fprintf(stderr, "Error: A %d x %d grid of cells can't be split over a %d x %d grid of processes.\n", global_x, global_y, dims[0], dims[1]);
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	int periods[2] = {1, 1};
+	MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cart_comm);
+	MPI_Cart_coords(cart_comm, rank, 2, coords);
+
+	split_x = (int *) malloc((dims[0] + 1) * sizeof(int));
+	split_y = (int *) malloc((dims[1] + 1) * sizeof(int));
+	for (int c = 0; c <= dims[0]; c++) {
+		split_x[c] = (int) (((long) global_x * c) / dims[0]);
+	}
+	for (int c = 0; c <= dims[1]; c++) {
+		split_y[c] = (int) (((long) global_y * c) / dims[1]);
+	}
+	set_block();
+
+	// the coordinates wrap around (since the grid is periodic), so the neighbours at the edges are on the other side
+	for (int d = 0; d < NUM_DIRS; d++) {
+		int c[2] = {coords[0] + DIR_X(d), coords[1] + DIR_Y(d)};
+		MPI_Cart_rank(cart_comm, c, &(neighbour[d]));
+	}
+
+	// a Cartesian communicator's neighbourhood collectives only reach the four neighbours that share a side, so the
+	// exchanges use a graph of all eight. Sending in direction d goes to neighbour[d], and receiving the data sent
+	// in direction d comes from the neighbour in the opposite direction. When the process grid is only 1 or 2 wide,
+	// a rank is a neighbour in several directions, but the messages between a pair of ranks are matched in order,
+	// and both list the directions in the same order. Each edge is weighted by the number of cells exchanged
+	// across it (as a hint to the library)
+	int sources[NUM_NEIGHBOURS];
+	int destinations[NUM_NEIGHBOURS];
+	int weights[NUM_NEIGHBOURS];
+	for (int d = 0; d < NUM_DIRS; d++) {
+		if (d == DIR_SELF) continue;
+		sources[NEIGHBOUR_INDEX(d)] = neighbour[DIR_OPPOSITE(d)];
+		destinations[NEIGHBOUR_INDEX(d)] = neighbour[d];
+		weights[NEIGHBOUR_INDEX(d)] = (DIR_X(d) == 0) ? x : (DIR_Y(d) == 0) ? y : 1;
+	}
+	MPI_Dist_graph_create_adjacent(cart_comm, NUM_NEIGHBOURS, sources, weights, NUM_NEIGHBOURS, destinations,
+	                               weights, MPI_INFO_NULL, 0, &halo_comm);
+}
+
+/**
+ * @brief Set the size of this rank's block (x and y) and where it starts, from the splits. All of the ranks in a
+ *        column of the process grid have the same columns of cells (and the same for the rows), so each block still
+ *        has a single neighbour in each direction.
+ *
+ */
+void set_block() {
+	offset_x = split_x[coords[0]];
+	offset_y = split_y[coords[1]];
+	x = split_x[coords[0]+1] - offset_x;
+	y = split_y[coords[1]+1] - offset_y;
+}
+
+/**
+ * @brief Free the communicators and the splits
+ *
+ */
+void free_decomposition() {
+	if (halo_comm != MPI_COMM_NULL) {
+		MPI_Comm_free(&halo_comm);
+	}
+	if (cart_comm != MPI_COMM_NULL) {
+		MPI_Comm_free(&cart_comm);
+	}
+	free(split_x);
+	free(split_y);
+	split_x = split_y = NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef DECOMP_H
+#define DECOMP_H
+
+#include <mpi.h>
+
+// the eight neighbouring blocks (and this one), indexed by (dx+1)*3 + (dy+1) for offsets dx, dy in -1..1
+#define NUM_DIRS 9
+#define DIR_SELF 4
+#define DIR_INDEX(dx, dy) (((dx)+1)*3 + ((dy)+1))
+#define DIR_X(d) ((d) / 3 - 1)
+#define DIR_Y(d) ((d) % 3 - 1)
+#define DIR_OPPOSITE(d) (NUM_DIRS - 1 - (d))
+
+// the eight neighbours (i.e. every direction except this block) are numbered in the same order in halo_comm
+#define NUM_NEIGHBOURS 8
+#define NEIGHBOUR_INDEX(d) (((d) < DIR_SELF) ? (d) : (d) - 1)
+
+// this process, the number of processes and the (periodic) Cartesian process grid they are arranged in
+extern int rank;
+extern int num_ranks;
+extern MPI_Comm cart_comm;
+extern int dims[2];
+extern int coords[2];
+
+// the number of OpenMP threads each rank runs (1 unless this is the hybrid build)
+extern int num_threads;
+
+// the rank that owns each neighbouring block
+extern int neighbour[NUM_DIRS];
+
+// a communicator connecting each rank to its eight neighbours, for the neighbourhood collectives
+extern MPI_Comm halo_comm;
+
+// the size of the whole grid of cells, and where this rank's block starts in it (x and y are the size of the block)
+extern int global_x;
+extern int global_y;
+extern int offset_x;
+extern int offset_y;
+
+// where the blocks start in each dimension (the columns split_x[c]+1 to split_x[c+1] belong to the ranks with x
+// coordinate c, and the same for the rows), so the blocks can be resized by moving the splits
+extern int * split_x;
+extern int * split_y;
+
+void decompose();
+void set_block();
+void free_decomposition();
+
+#endif
@@ -3,89 +3,136 @@
 #include <math.h>
 #include <time.h>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "args.h"
+#include "balance.h"
 #include "boundary.h"
 #include "data.h"
+#include "decomp.h"
 #include "setup.h"
 #include "vtk.h"
 
+/**
+ * @brief Calculate the acceleration felt by each particle in a cell, based on evaluating the Lennard-Jones
+ *        potential with its neighbours in the 9 cells around it. It only evaluates particles within a cut-off
+ *        radius. It also calculates their potential energy.
+ *
+ * @param i The x index of the cell
+ * @param j The y index of the cell
+ * @return double The potential energy of the particles in the cell
+ */
+static double comp_accel_cell(int i, int j) {
+	double pot_energy = 0.0;
+
+	double cell_offset_x = (i-1) * cell_size;
+	double cell_offset_y = (j-1) * cell_size;
+	struct particle_t * p = cells[i][j].head;
+	while (p != NULL) {
+		// zero the acceleration, then add the force from each neighbour
+		p->ax = 0.0;
+		p->ay = 0.0;
+
+		// Compare each particle with all particles in the 9 cells
+		for (int a = -1; a <= 1; a++) {
+			for (int b = -1; b <= 1; b++) {
+				struct particle_t * q = cells[i+a][j+b].head;
+				while (q != NULL) {
+					// if p and q are the same particle, skip
+					if (p == q) {
+						q = q->next;
+						continue;
+					}
+
+					// since particles are stored relative to their cell, calculate the
+					// actual x and y coordinates.
+					double p_real_x = (cell_offset_x) + p->x;
+					double p_real_y = (cell_offset_y) + p->y;
+					double q_real_x = ((i+a-1) * cell_size) + q->x;
+					double q_real_y = ((j+b-1) * cell_size) + q->y;
+					
+					// calculate distance in x and y, then absolute distance
+					// calculate distance in x and y, then absolute distance
+					double dx = p_real_x - q_real_x;
+					double dy = p_real_y - q_real_y;
+					double r_2 = dx * dx + dy * dy;
+					double r_2_inv = 1.0 / r_2;
+					double r_6_inv = r_2_inv * r_2_inv * r_2_inv;
+
+					// calculate squared distance
+					double r_2_minus_cutoff_2 = r_2 - r_cut_off_2;
+
+					// if squared distance less than cut off, calculate force and 
+					// use this to calculate acceleration in each dimension
+					// calculate potential energy of each particle at the same time
+					if (r_2_minus_cutoff_2 < 0.0) {
+						double f = 48.0 * r_2_inv * r_6_inv * (r_6_inv - 0.5);
+
+						p->ax += f * dx;
+						p->ay += f * dy;
+
+						pot_energy += 4.0 * r_6_inv * (r_6_inv - 1.0) - Uc - Duc * (sqrt(r_2) - r_cut_off);
+					}
+					q = q->next;
+				}
+			}
+		}
+		p = p->next;
+	}
+
+	return pot_energy;
+}
+
 /**
  * @brief This routine calculates the acceleration felt by each particle based on evaluating the Lennard-Jones 
  *        potential with its neighbours. It only evaluates particles within a cut-off radius, and uses cells to 
- *        reduce the search space. It also calculates the potential energy of the system. 
+ *        reduce the search space. It also calculates the potential energy of the system. The ghost cells are
+ *        filled with the neighbouring ranks' particles at the same time: the exchange is started first, then
+ *        the interior cells (which don't need the ghost cells) are done while the messages are on their way,
+ *        and the cells at the edges of the block once they have arrived.
  * 
- * @return double The potential energy
+ * @return double The potential energy (this rank's share of the average)
  */
 double comp_accel() {
-	// zero acceleration for every particle
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				p->ax = 0.0;
-				p->ay = 0.0;
-				p = p->next;
+	double pot_energy = 0.0;
+
+	// (in the hybrid build the cells are shared between the threads, while the master thread does the exchange)
+	#pragma omp parallel reduction(+:pot_energy)
+	{
+		#pragma omp master
+		start_boundary();
+
+		#pragma omp for collapse(2) schedule(dynamic) nowait
+		for (int i = 2; i < x; i++) {
+			for (int j = 2; j < y; j++) {
+				pot_energy += comp_accel_cell(i, j);
 			}
 		}
-	}
 
-	double pot_energy = 0.0;
+		#pragma omp master
+		finish_boundary();
 
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			double cell_offset_x = (i-1) * cell_size;
-			double cell_offset_y = (j-1) * cell_size;
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				// Compare each particle with all particles in the 9 cells
-				for (int a = -1; a <= 1; a++) {
-					for (int b = -1; b <= 1; b++) {
-						struct particle_t * q = cells[i+a][j+b].head;
-						while (q != NULL) {
-							// if p and q are the same particle, skip
-							if (p == q) {
-								q = q->next;
-								continue;
-							}
-
-							// since particles are stored relative to their cell, calculate the
-							// actual x and y coordinates.
-							double p_real_x = (cell_offset_x) + p->x;
-							double p_real_y = (cell_offset_y) + p->y;
-							double q_real_x = ((i+a-1) * cell_size) + q->x;
-							double q_real_y = ((j+b-1) * cell_size) + q->y;
-							
-							// calculate distance in x and y, then absolute distance
-							// calculate distance in x and y, then absolute distance
-							double dx = p_real_x - q_real_x;
-							double dy = p_real_y - q_real_y;
-							double r_2 = dx * dx + dy * dy;
-							double r_2_inv = 1.0 / r_2;
-							double r_6_inv = r_2_inv * r_2_inv * r_2_inv;
-
-							// calculate squared distance
-							double r_2_minus_cutoff_2 = r_2 - r_cut_off_2;
-
-							// if squared distance less than cut off, calculate force and 
-							// use this to calculate acceleration in each dimension
-							// calculate potential energy of each particle at the same time
-							if (r_2_minus_cutoff_2 < 0.0) {
-    							double f = 48.0 * r_2_inv * r_6_inv * (r_6_inv - 0.5);
-
-    							p->ax += f * dx;
-    							p->ay += f * dy;
-
-    							pot_energy += 4.0 * r_6_inv * (r_6_inv - 1.0) - Uc - Duc * (sqrt(r_2) - r_cut_off);
-							}
-							q = q->next;
-						}
-					}
+		// the edge cells need the ghost cells, so wait for the master thread to fill them
+		#pragma omp barrier
+
+		// the first and last columns, then the first and last rows between them
+		#pragma omp for schedule(dynamic)
+		for (int i = 1; i < x+1; i++) {
+			if ((i == 1) || (i == x)) {
+				for (int j = 1; j < y+1; j++) {
+					pot_energy += comp_accel_cell(i, j);
+				}
+			} else {
+				pot_energy += comp_accel_cell(i, 1);
+				if (y > 1) {
+					pot_energy += comp_accel_cell(i, y);
 				}
-				p = p->next;
 			}
 		}
 	}
+
 	// return the average potential energy (i.e. sum / number)
 	return pot_energy / num_particles;
 }
@@ -97,6 +144,7 @@ double comp_accel() {
  */
 void move_particles() {
 	// move all particles half a time step
+	#pragma omp parallel for schedule(static)
 	for (int i = 1; i < x+1; i++) {
 		for (int j = 1; j < y+1; j++) {
 			struct particle_t * p = cells[i][j].head;
@@ -119,7 +167,9 @@ void move_particles() {
  * @brief This routine updates the cell lists. If a particles coordinates are not within a cell
  *        any more, this function calculates the cell it should be in and performs the move.
  *        If a particle moves more than 1 cell in any direction, this indicates poor settings
- *        and therefore an error is generated.
+ *        and therefore an error is generated. Particles that leave this rank's block are packed
+ *        up as they leave, to be sent to their new rank by migrate_particles. This isn't threaded in the
+ *        hybrid build, since particles move between the cells (and the outgoing buffers are shared).
  * 
  */
 void update_cells() {
@@ -136,28 +186,29 @@ void update_cells() {
 				if ((p->x < 0.0) | (p->x >= cell_size) | (p->y < 0.0) | (p->y >= cell_size)) {
 					if ((p->x < (-cell_size)) || (p->x >= (2*cell_size)) || (p->y < (-cell_size)) || (p->y >= (2*cell_size))) {
 						fprintf(stderr, "A particle has moved more than one cell!\n");
-						exit(1);
+						MPI_Abort(MPI_COMM_WORLD, 1);
 					}
 
 					// work out whether we've moved a cell in the x and the y dimension
 					int x_shift = (p->x < 0.0) ? -1 : (p->x >= cell_size) ? +1 : 0;
 					int y_shift = (p->y < 0.0) ? -1 : (p->y >= cell_size) ? +1 : 0;
 					
-					// the new i and j are +/- 1 in each dimension,
-					// but if that means we go out of simulation bounds, wrap it to x and 1
+					// the new i and j are +/- 1 in each dimension (if that means we go out of
+					// this rank's block, the particle will be migrated)
 					int new_i = i+x_shift;
-					if (new_i == 0) { new_i = x; }
-					if (new_i == x+1) { new_i = 1; }
 					int new_j = j+y_shift;
-					if (new_j == 0) { new_j = y; }
-					if (new_j == y+1) { new_j = 1; }
 					// update x and y coordinates (i.e. remove the additional cell size)
 					p->x = p->x + (x_shift * -cell_size);
 					p->y = p->y + (y_shift * -cell_size);
 
 					// remove the particle from its current cell list, then add it to the new cell list
+					// (or pack it up to send to the rank that owns the new cell)
 					remove_particle(&(cells[i][j]), p);
-					add_particle(&(cells[new_i][new_j]), p);
+					if ((new_i < 1) || (new_i > x) || (new_j < 1) || (new_j > y)) {
+						depart_particle(p, new_i, new_j);
+					} else {
+						add_particle(&(cells[new_i][new_j]), p);
+					}
 				}
 				p = p_next;
 			}
@@ -175,6 +226,7 @@ void update_cells() {
 double update_velocity() {
 	double kinetic_energy = 0.0;
 
+	#pragma omp parallel for schedule(static) reduction(+:kinetic_energy)
 	for (int i = 1; i < x+1; i++) {
 		for (int j = 1; j < y+1; j++) {
 			struct particle_t * p = cells[i][j].head;
@@ -196,6 +248,125 @@ double update_velocity() {
 	return kinetic_energy;
 }
 
+// the values added up over every rank for a report: the potential and kinetic energies, the number of particles,
+// and the most particles on any rank (which is found with a maximum rather than a sum)
+#define REPORT_SIZE 4
+#define REPORT_POTENTIAL 0
+#define REPORT_KINETIC 1
+#define REPORT_PARTICLES 2
+#define REPORT_MOST_PARTICLES 3
+
+// a report being added up, which is printed once it has been (while the next step is worked on)
+static MPI_Datatype report_type = MPI_DATATYPE_NULL;
+static MPI_Op report_op = MPI_OP_NULL;
+static MPI_Request report_request = MPI_REQUEST_NULL;
+static double report[REPORT_SIZE];
+static int report_iters;
+static double report_t;
+
+/**
+ * @brief Combine the reports from two ranks (adding up everything but the most particles on a rank). Each report is
+ *        a single element of report_type, so the values are never split between calls.
+ *
+ * @param in The reports to combine with
+ * @param inout The reports to combine into
+ * @param len The number of reports
+ * @param type The datatype (report_type)
+ */
+static void combine_reports(void * in, void * inout, int * len, MPI_Datatype * type) {
+	(void) type;
+	double * a = (double *) in;
+	double * b = (double *) inout;
+	for (int k = 0; k < *len * REPORT_SIZE; k += REPORT_SIZE) {
+		b[k+REPORT_POTENTIAL] += a[k+REPORT_POTENTIAL];
+		b[k+REPORT_KINETIC] += a[k+REPORT_KINETIC];
+		b[k+REPORT_PARTICLES] += a[k+REPORT_PARTICLES];
+		if (a[k+REPORT_MOST_PARTICLES] > b[k+REPORT_MOST_PARTICLES]) {
+			b[k+REPORT_MOST_PARTICLES] = a[k+REPORT_MOST_PARTICLES];
+		}
+	}
+}
+
+/**
+ * @brief Fill in this rank's values for a report
+ *
+ * @param values The report
+ * @param potential_energy This rank's share of the potential energy
+ * @param kinetic_energy This rank's share of the kinetic energy
+ */
+static void fill_report(double * values, double potential_energy, double kinetic_energy) {
+	values[REPORT_POTENTIAL] = potential_energy;
+	values[REPORT_KINETIC] = kinetic_energy;
+	values[REPORT_PARTICLES] = count_local_particles();
+	values[REPORT_MOST_PARTICLES] = values[REPORT_PARTICLES];
+}
+
+/**
+ * @brief Start adding up a report over every rank (with a single non-blocking reduction), to be printed by
+ *        finish_report
+ *
+ * @param iters The step
+ * @param t The time at the end of the step
+ * @param potential_energy This rank's share of the potential energy
+ * @param kinetic_energy This rank's share of the kinetic energy
+ */
+static void start_report(int iters, double t, double potential_energy, double kinetic_energy) {
+	if (report_type == MPI_DATATYPE_NULL) {
+		MPI_Type_contiguous(REPORT_SIZE, MPI_DOUBLE, &report_type);
+		MPI_Type_commit(&report_type);
+		MPI_Op_create(combine_reports, 1, &report_op);
+	}
+
+	fill_report(report, potential_energy, kinetic_energy);
+	report_iters = iters;
+	report_t = t;
+	MPI_Iallreduce(MPI_IN_PLACE, report, 1, report_type, report_op, cart_comm, &report_request);
+}
+
+/**
+ * @brief Wait for the report started by start_report (if there is one) and print it. This also checks that no
+ *        particles have been lost.
+ *
+ */
+static void finish_report() {
+	if (report_request == MPI_REQUEST_NULL) {
+		return;
+	}
+	MPI_Wait(&report_request, MPI_STATUS_IGNORE);
+
+	if ((long) report[REPORT_PARTICLES] != num_particles) {
+		if (rank == 0) {
+			fprintf(stderr, "Error: There are %ld particles at step %d, but there should be %d.\n", (long) report[REPORT_PARTICLES], report_iters, num_particles);
+		}
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	if (rank == 0) {
+		// calculate temperature and total energy
+		double potential_energy = report[REPORT_POTENTIAL];
+		double kinetic_energy = report[REPORT_KINETIC];
+		double total_energy = kinetic_energy + potential_energy;
+		double temp = kinetic_energy * 2.0 / 3.0;
+		printf("Step %8d, Time: %14.8e (dt: %14.8e), Total energy: %14.8e (p:%14.8e,k:%14.8e), Temp: %14.8e\n", report_iters, report_t, dt, total_energy, potential_energy, kinetic_energy, temp);
+
+		// report how evenly the particles are shared (the most on a rank over the mean)
+		if (num_ranks > 1) {
+			printf("               Imbalance: %14.8e\n", report[REPORT_MOST_PARTICLES] / ((double) num_particles / num_ranks));
+		}
+	}
+}
+
+/**
+ * @brief Free the datatype and operation used for the reports
+ *
+ */
+static void free_reports() {
+	if (report_type != MPI_DATATYPE_NULL) {
+		MPI_Type_free(&report_type);
+		MPI_Op_free(&report_op);
+	}
+}
+
 /**
  * @brief This is the main routine that sets up the problem space and then drives the solving routines.
  * 
@@ -204,28 +375,22 @@ double update_velocity() {
  * @return int The exit code of the application
  */
 int main(int argc, char *argv[]) {
-	int rank, size;
-
+#ifdef _OPENMP
+	// in the hybrid build, only the master thread of each rank makes MPI calls
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	if (provided < MPI_THREAD_FUNNELED) {
+		fprintf(stderr, "Error: The MPI library doesn't support MPI_THREAD_FUNNELED.\n");
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	num_threads = omp_get_max_threads();
+#else
     MPI_Init(&argc, &argv);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-
-	int startj = rank * (x/size) - 1;
-    if (startj < 0) startj = 0;
-    int endj = (rank+1) * (x/size);
-    if (endj >= x-1) endj = x - 1;
-
-    // calculated the size of the array on each parallel processor
-    int sizej = endj - startj + 1;
-
-	struct cell_list ** u = alloc_2d_cell_list_array(x, sizej);
-    struct cell_list ** w = alloc_2d_cell_list_array(x, sizej);
-
-
-	clock_t start_time, end_time;
-
-	start_time = clock();
+	double start_time = MPI_Wtime();
 
 	// Set default parameters
 	set_defaults();
@@ -233,89 +398,85 @@ int main(int argc, char *argv[]) {
 	parse_args(argc, argv);
 	// call set up to update defaults
 	setup();
+	// split the cells into a block for each rank
+	decompose();
+	// and set up the exchanges with the neighbouring blocks
+	setup_boundary();
 
-	if (verbose) print_opts();
+	if (verbose && (rank == 0)) print_opts();
 	
-	// set up problem
+	// set up problem (each rank creates the particles in its own block)
 	problem_setup();
 
-	// apply boundary condition (i.e. update pointers on the boundarys to loop periodically)
-	apply_boundary();
-	
+	// compute the initial accelerations (this also fills the ghost cells with the neighbouring ranks' particles)
 	comp_accel();
 
-	int rows_per_rank = x / size;
-
-	MPI_Datatype my_column;
-    MPI_Type_vector(y, 1, sizej, MPI_DOUBLE, &my_column);
-    MPI_Type_commit(&my_column);
-
 	double potential_energy = 0.0;
 	double kinetic_energy = 0.0;
 
-	double placeholder = 2.0 / 3.0;
-
 	int iters = 0;
 	double t;
 	for (t = 0.0; t < t_end; t+=dt, iters++) {
-
-		int left = (rank - 1) < 0 ? MPI_PROC_NULL : rank - 1;
-        int right = (rank + 1) >= size ? MPI_PROC_NULL : rank + 1;
-
-		MPI_Sendrecv(&(w[0][1]), 1, my_column, left, 0, &(w[0][sizej-1]), 1, my_column, right, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-       	MPI_Sendrecv(&(w[0][sizej-2]), 1, my_column, right, 0, &(w[0][0]), 1, my_column, left, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
 		// move particles half a time step
 		move_particles();
 
 		// update cell lists (i.e. move any particles between cell lists if required)
 		update_cells();
 
-		// update pointers (because the previous operation might break boundary cell lists)
-		apply_boundary();
-		
-		// compute acceleration for each particle and calculate potential energy
+		// send the particles that have left this rank's block to the ranks that now own them
+		migrate_particles();
+
+		// every so often, move the edges of the blocks if the particles are shared too unevenly
+		if ((balance_freq > 0) && (iters % balance_freq == 0)) {
+			balance_load();
+		}
+
+		// compute acceleration for each particle and calculate potential energy (updating the ghost cells,
+		// because the particles have moved, while the interior cells are computed)
 		potential_energy = comp_accel();
 
-		// update velocity based on the acceleration and calculate the kinetic energy
+		// the last output step's report has been added up while this step was worked on, so print it
+		finish_report();
+
+		// update velocity based on the acceleration and calculate the kinetic energy (both are this rank's share)
 		kinetic_energy = update_velocity();
 
-		MPI_Allreduce(MPI_IN_PLACE, &diff, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
-	
 		if (iters % output_freq == 0) {
-			// calculate temperature and total energy
-			double total_energy = kinetic_energy + potential_energy;
-			double temp = kinetic_energy * placeholder;
-
-			printf("Step %8d, Time: %14.8e (dt: %14.8e), Total energy: %14.8e (p:%14.8e,k:%14.8e), Temp: %14.8e\n", iters, t+dt, dt, total_energy, potential_energy, kinetic_energy, temp);
+			// add up the energies over every rank (only on output steps, in a single reduction)
+			start_report(iters, t+dt, potential_energy, kinetic_energy);
  
-			// if output is enabled and checkpointing is enabled, write out
+			// if output is enabled and checkpointing is enabled, write out (every rank takes part)
             if ((!no_output) && (enable_checkpoints))
                 write_checkpoint(iters, t+dt);
 		}
 	}
-
-	// calculate the final energy and write out a final status message
-	double final_energy = kinetic_energy + potential_energy;
-	printf("Step %8d, Time: %14.8e, Final energy: %14.8e\n", iters, t, final_energy);
-    printf("Simulation complete.\n");
+	finish_report();
+
+	// calculate the final energy (over every rank) and write out a final status message
+	double energies[2] = {potential_energy, kinetic_energy};
+	MPI_Allreduce(MPI_IN_PLACE, energies, 2, MPI_DOUBLE, MPI_SUM, cart_comm);
+	double final_energy = energies[0] + energies[1];
+	if (rank == 0) {
+		printf("Step %8d, Time: %14.8e, Final energy: %14.8e\n", iters, t, final_energy);
+		printf("Simulation complete.\n");
+	}
 
 	// if output is enabled, write the mesh file and the final state
 	if (!no_output) {
-		write_mesh();
+		if (rank == 0) write_mesh();
 		write_result(iters, t);
 	}
 
-	end_time = clock();
-
-	double total_cpu_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+	double end_time = MPI_Wtime();
 
-	printf("total cpu time: %lf seconds \n", total_cpu_time);
+	if (rank == 0) {
+		printf("total time: %lf seconds \n", end_time - start_time);
+	}
 
-	MPI_Type_free(&my_column);
+	free_reports();
+	free_boundary();
+	free_decomposition();
 	MPI_Finalize();
 
 	return 0;
-}
-
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include "setup.h"
 #include "data.h"
+#include "decomp.h"
 #include "vtk.h"
 
 /**
@@ -39,13 +40,16 @@ void setup() {
  * @brief Set up the problem space, initialise the cells to contain particles,
  *        set the particles to exist on a regular lattice, set their velocities
  *        to be consistent with the initial temperature, but in random orientation.
+ *        Every rank draws the random velocities of every particle (in the same order
+ *        as the serial code), so the initial state is the same for any number of ranks,
+ *        but each only creates the particles in its own block.
  * 
  */
 void problem_setup() {
 	
-	// Create a grid of cell lists
+	// Create a grid of cell lists (for this rank's block, with a layer of ghost cells around it)
 	cells = alloc_2d_cell_list_array(x+2, y+2);
-	num_particles = x * y * num_part_per_dim * num_part_per_dim;
+	num_particles = global_x * global_y * num_part_per_dim * num_part_per_dim;
 
 	double v_sum_x = 0.0;
 	double v_sum_y = 0.0;
@@ -55,8 +59,10 @@ void problem_setup() {
 	// set the normalisation magnitude using the ideal gas law (T = mv^2 / 3)
 	double v_magnitude = sqrt(3.0 * init_temp);
 
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
+	int part_id = 0;
+	for (int i = 1; i < global_x+1; i++) {
+		for (int j = 1; j < global_y+1; j++) {
+			int local = (i > offset_x) && (i <= offset_x + x) && (j > offset_y) && (j <= offset_y + y);
 			for (int a = 0; a < num_part_per_dim; a++) {
 				for (int b = 0; b < num_part_per_dim; b++) {
 					// set the particles x and y values within the current cell (on a lattice based on number of particles per cell, per dimension)
@@ -69,16 +75,22 @@ void problem_setup() {
 					double rand_vx = cos(phi);
 					double rand_vy = sin(phi);
 
-					// create the particle and add it to the current cell list.			
-					struct particle_t * p = malloc(sizeof(struct particle_t));
-					p->x = part_x * cell_size;
-					p->y = part_y * cell_size;
-					p->vx = rand_vx * v_magnitude;
-					p->vy = rand_vy * v_magnitude;
-					add_particle(&(cells[i][j]), p);
-
-					v_sum_x += p->vx;
-					v_sum_y += p->vy;
+					double vx = rand_vx * v_magnitude;
+					double vy = rand_vy * v_magnitude;
+					v_sum_x += vx;
+					v_sum_y += vy;
+
+					// create the particle and add it to the current cell list (if the cell is in this rank's block).
+					if (local) {
+						struct particle_t * p = malloc(sizeof(struct particle_t));
+						p->x = part_x * cell_size;
+						p->y = part_y * cell_size;
+						p->vx = vx;
+						p->vy = vy;
+						p->part_id = part_id;
+						add_particle(&(cells[i-offset_x][j-offset_y]), p);
+					}
+					part_id++;
 				}
 			}	
 		}
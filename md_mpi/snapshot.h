@@ -0,0 +1,24 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+// the start of every binary snapshot file
+#define SNAPSHOT_MAGIC "MDSNAP\0\0"
+#define SNAPSHOT_VERSION 1
+
+// a binary snapshot is this header, then the position (x, y) of every particle as doubles, then the id of every
+// particle as 32 bit ints (both in the same order, rank by rank). Everything is in the byte order of the machine
+// that wrote it
+struct snapshot_header {
+	char magic[8];
+	int32_t version;
+	int32_t iters;
+	double t;
+	int64_t num_particles;
+	int32_t global_x;
+	int32_t global_y;
+	double cell_size;
+};
+
+#endif
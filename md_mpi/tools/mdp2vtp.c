@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../snapshot.h"
+
+// the number of particles read at a time (so the snapshot doesn't have to fit in memory)
+#define CHUNK 4096
+
+/**
+ * @brief Convert a binary snapshot written by md -B (see snapshot.h) to a particle VTK file (i.e. a .vtp file),
+ *        the same as md writes without -B.
+ *
+ * @param argc The number of arguments passed to the program
+ * @param argv The snapshot to read, and optionally the file to write (by default the snapshot's name, ending .vtp)
+ * @return int The exit code of the application
+ */
+int main(int argc, char *argv[]) {
+	if ((argc < 2) || (argc > 3)) {
+		fprintf(stderr, "Usage: %s SNAPSHOT.mdp [OUTPUT.vtp]\n", argv[0]);
+		exit(1);
+	}
+
+	char filename[1024];
+	if (argc == 3) {
+		snprintf(filename, sizeof(filename), "%s", argv[2]);
+	} else {
+		snprintf(filename, sizeof(filename), "%s", argv[1]);
+		char * ext = strrchr(filename, '.');
+		if ((ext != NULL) && (strcmp(ext, ".mdp") == 0)) {
+			*ext = '\0';
+		}
+		strncat(filename, ".vtp", sizeof(filename) - strlen(filename) - 1);
+	}
+
+	FILE * in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror("Error");
+		exit(1);
+	}
+
+	struct snapshot_header header;
+	if ((fread(&header, sizeof(header), 1, in) != 1) || (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)) {
+		fprintf(stderr, "Error: %s isn't a snapshot.\n", argv[1]);
+		exit(1);
+	}
+	if (header.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "Error: %s is a version %d snapshot (expected version %d).\n", argv[1], header.version, SNAPSHOT_VERSION);
+		exit(1);
+	}
+
+	FILE * f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("Error");
+		exit(1);
+	}
+
+	fprintf(f, "<?xml version=\"1.0\"?>\n");
+	fprintf(f, "<VTKFile type=\"PolyData\" version=\"0.1\" byte_order=\"LittleEndian\">\n");
+	fprintf(f, "<PolyData>\n");
+	fprintf(f, "<FieldData>\n");
+	fprintf(f, "<DataArray type=\"Float64\" Name=\"TIME\" NumberOfTuples=\"1\" format=\"ascii\">\n");
+	fprintf(f, "%.12e\n", header.t);
+	fprintf(f, "</DataArray>\n");
+	fprintf(f, "<DataArray type=\"Int32\" Name=\"CYCLE\" NumberOfTuples=\"1\" format=\"ascii\">\n");
+	fprintf(f, "%d\n", header.iters);
+	fprintf(f, "</DataArray>\n");
+	fprintf(f, "</FieldData>\n");
+	fprintf(f, "<Piece NumberOfPoints=\"%lld\" NumberOfVerts=\"0\" NumberOfLines=\"0\" NumberOfStrips=\"0\" NumberOfCells=\"0\">\n", (long long) header.num_particles);
+	fprintf(f, "<Points>\n");
+	fprintf(f, "<DataArray type=\"Float64\" Name=\"particles\" NumberOfComponents=\"3\" format=\"ascii\">\n");
+
+	double pos[2 * CHUNK];
+	for (int64_t k = 0; k < header.num_particles; k += CHUNK) {
+		size_t n = (header.num_particles - k < CHUNK) ? (size_t) (header.num_particles - k) : CHUNK;
+		if (fread(pos, 2 * sizeof(double), n, in) != n) {
+			fprintf(stderr, "Error: %s is truncated.\n", argv[1]);
+			exit(1);
+		}
+		for (size_t m = 0; m < n; m++) {
+			fprintf(f, "%.12e %.12e 0 \n", pos[2*m], pos[2*m+1]);
+		}
+	}
+
+	fprintf(f, "\n</DataArray>\n");
+	fprintf(f, "</Points>\n");
+	fprintf(f, "</Piece>\n");
+	fprintf(f, "</PolyData>\n");
+	fprintf(f, "</VTKFile>\n");
+	fclose(f);
+	fclose(in);
+	return 0;
+}
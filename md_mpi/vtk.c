@@ -2,13 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <mpi.h>
 
 #include "vtk.h"
+#include "args.h"
 #include "data.h"
+#include "decomp.h"
+#include "snapshot.h"
 
 char checkpoint_basename[1024];
 char result_filename[1024];
 char mesh_filename[1024];
+char snapshot_basename[1024];
+char snapshot_filename[1024];
 
 /**
  * @brief Set the default basename for file output to out/vortex
@@ -29,6 +36,8 @@ void set_basename(char *base) {
     sprintf(checkpoint_basename, "%s-%%d.vtp", base);
     sprintf(result_filename, "%s.vtp", base);
 	sprintf(mesh_filename, "%s-mesh.vti", base);
+	sprintf(snapshot_basename, "%s-%%d.mdp", base);
+	sprintf(snapshot_filename, "%s.mdp", base);
 }
 
 /**
@@ -41,28 +50,114 @@ char *get_basename() {
 }
 
 /**
- * @brief Write a checkpoint VTK file (with the iteration number in the filename)
+ * @brief Write a checkpoint file (with the iteration number in the filename), either a VTK file or a binary
+ *        snapshot
  * 
  * @param iteration The current iteration number
  * @return int Return whether the write was successful
  */
 int write_checkpoint(int iters, double t) { 
     char filename[1024];
+    if (binary_output) {
+        sprintf(filename, snapshot_basename, iters);
+        return write_snapshot(filename, iters, t);
+    }
     sprintf(filename, checkpoint_basename, iters);
     return write_vtk(filename, iters, t);
 }
 
 /**
- * @brief Write the final output to a VTK file
+ * @brief Write the final output, either to a VTK file or a binary snapshot
  * 
  * @return int Return whether the write was successful
  */
 int write_result(int iters, double t) {
+    if (binary_output) {
+        return write_snapshot(snapshot_filename, iters, t);
+    }
     return write_vtk(result_filename, iters, t);
 }
 
 /**
- * @brief Write out a particle VTK file (i.e. a .vtp file).
+ * @brief Write out a binary snapshot of the particles (see snapshot.h), which tools/mdp2vtp converts to a VTK file.
+ *        Every rank writes its own particles straight into the shared file with collective MPI-IO, at an offset
+ *        found by adding up the number of particles on the ranks before it (so nothing is gathered on one rank).
+ *        This must be called by every rank.
+ * 
+ * @param filename The filename to use for output
+ * @param iters The number of iterations
+ * @param t The simulation time
+ * @return int Return whether the write was successful
+ */
+int write_snapshot(char * filename, int iters, double t) {
+	int count = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				count++;
+			}
+		}
+	}
+	double * pos = (double *) malloc((2 * count + 1) * sizeof(double));
+	int32_t * ids = (int32_t *) malloc((count + 1) * sizeof(int32_t));
+	int n = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				ids[n/2] = p->part_id;
+				pos[n++] = ((i-1+offset_x) * cell_size) + p->x;
+				pos[n++] = ((j-1+offset_y) * cell_size) + p->y;
+			}
+		}
+	}
+
+	// this rank's particles go after those of the ranks before it (the scan leaves rank 0's undefined)
+	long long local = count;
+	long long first = 0;
+	MPI_Exscan(&local, &first, 1, MPI_LONG_LONG, MPI_SUM, cart_comm);
+	if (rank == 0) {
+		first = 0;
+	}
+
+	MPI_File fh;
+	int err = MPI_File_open(cart_comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+	if (err != MPI_SUCCESS) {
+		if (rank == 0) {
+			fprintf(stderr, "Error: Couldn't open %s for writing.\n", filename);
+		}
+		free(pos);
+		free(ids);
+		return -1;
+	}
+	MPI_File_set_size(fh, 0);
+
+	if (rank == 0) {
+		struct snapshot_header header;
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = SNAPSHOT_VERSION;
+		header.iters = iters;
+		header.t = t;
+		header.num_particles = num_particles;
+		header.global_x = global_x;
+		header.global_y = global_y;
+		header.cell_size = cell_size;
+		MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+	}
+
+	MPI_Offset pos_start = sizeof(struct snapshot_header);
+	MPI_Offset ids_start = pos_start + (MPI_Offset) num_particles * 2 * sizeof(double);
+	MPI_File_write_at_all(fh, pos_start + first * 2 * sizeof(double), pos, 2 * count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+	MPI_File_write_at_all(fh, ids_start + first * sizeof(int32_t), ids, count, MPI_INT32_T, MPI_STATUS_IGNORE);
+	MPI_File_close(&fh);
+
+	free(pos);
+	free(ids);
+	return 0;
+}
+
+/**
+ * @brief Write out a particle VTK file (i.e. a .vtp file). Every rank sends the positions of its
+ *        particles to rank 0, which writes the file, so this must be called by every rank.
  * 
  * @param filename The filename to use for output
  * @param iters The number of iterations
@@ -70,9 +165,54 @@ int write_result(int iters, double t) {
  * @return int Return whether the write was successful
  */
 int write_vtk(char * filename, int iters, double t) {
+	// gather the (real) positions of every rank's particles on rank 0
+	int count = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				count++;
+			}
+		}
+	}
+	double * pos = (double *) malloc((2 * count + 1) * sizeof(double));
+	int n = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			for (struct particle_t * p = cells[i][j].head; p != NULL; p = p->next) {
+				pos[n++] = ((i-1+offset_x) * cell_size) + p->x;
+				pos[n++] = ((j-1+offset_y) * cell_size) + p->y;
+			}
+		}
+	}
+
+	int * counts = NULL;
+	int * displs = NULL;
+	double * all_pos = NULL;
+	if (rank == 0) {
+		counts = (int *) malloc(num_ranks * sizeof(int));
+		displs = (int *) malloc(num_ranks * sizeof(int));
+	}
+	MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, cart_comm);
+	if (rank == 0) {
+		displs[0] = 0;
+		for (int r = 1; r < num_ranks; r++) {
+			displs[r] = displs[r-1] + counts[r-1];
+		}
+		all_pos = (double *) malloc((2 * num_particles + 1) * sizeof(double));
+	}
+	MPI_Gatherv(pos, n, MPI_DOUBLE, all_pos, counts, displs, MPI_DOUBLE, 0, cart_comm);
+	free(pos);
+	free(counts);
+	free(displs);
+
+	if (rank != 0) {
+		return 0;
+	}
+
 	FILE * f = fopen(filename, "w");
     if (f == NULL) {
         perror("Error");
+        free(all_pos);
         return -1;
     }
 	
@@ -90,16 +230,8 @@ int write_vtk(char * filename, int iters, double t) {
 	fprintf(f, "<Piece NumberOfPoints=\"%d\" NumberOfVerts=\"0\" NumberOfLines=\"0\" NumberOfStrips=\"0\" NumberOfCells=\"0\">\n", num_particles);
 	fprintf(f, "<Points>\n");
 	fprintf(f, "<DataArray type=\"Float64\" Name=\"particles\" NumberOfComponents=\"3\" format=\"ascii\">\n");
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				double p_real_x = ((i-1) * cell_size) + p->x;
-				double p_real_y = ((j-1) * cell_size) + p->y;
-				fprintf(f, "%.12e %.12e 0 \n", p_real_x, p_real_y);
-				p = p->next;
-			}
-		}
+	for (int k = 0; k < num_particles; k++) {
+		fprintf(f, "%.12e %.12e 0 \n", all_pos[2*k], all_pos[2*k+1]);
 	}
 	
 	fprintf(f, "\n</DataArray>\n");
@@ -108,6 +240,7 @@ int write_vtk(char * filename, int iters, double t) {
 	fprintf(f, "</PolyData>\n");
 	fprintf(f, "</VTKFile>\n");
 	fclose(f);
+	free(all_pos);
 	return 0;
 }
 
@@ -126,8 +259,8 @@ int write_mesh() {
 
 	fprintf(f, "<?xml version=\"1.0\"?>\n");
 	fprintf(f, "<VTKFile type=\"ImageData\" version=\"0.1\" byte_order=\"LittleEndian\">\n");
-	fprintf(f, "<ImageData WholeExtent=\"0 %d 0 %d 0 0\" Origin=\"0 0 0\" Spacing=\"%lf %lf 0\">\n", x, y, cell_size, cell_size);
-	fprintf(f, "<Piece Extent=\"0 %d 0 %d 0 0\">\n", x, y);
+	fprintf(f, "<ImageData WholeExtent=\"0 %d 0 %d 0 0\" Origin=\"0 0 0\" Spacing=\"%lf %lf 0\">\n", global_x, global_y, cell_size, cell_size);
+	fprintf(f, "<Piece Extent=\"0 %d 0 %d 0 0\">\n", global_x, global_y);
 	fprintf(f, "<CellData></CellData>\n");
 	fprintf(f, "<PointData></PointData>\n");
 	fprintf(f, "<Points></Points>\n");
@@ -7,6 +7,7 @@ char *get_basename();
 int write_checkpoint(int iters, double t);
 int write_result(int iters, double t);
 int write_vtk(char* filename, int iters, double t);
+int write_snapshot(char * filename, int iters, double t);
 int write_mesh();
 
 #endif
\ No newline at end of file
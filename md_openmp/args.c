@@ -7,11 +7,19 @@
 #include "args.h"
 #include "data.h"
 #include "vtk.h"
+#include "kernel.h"
+#include "potential.h"
+#include "order.h"
+#include "rng.h"
+#include "stencil.h"
 
 int verbose = 0;
 int no_output = 0;
 int output_freq = 100;
 int enable_checkpoints = 0;
+int half_shell = 0;
+int mixed_precision = 0;
+int fused = 0;
 
 static struct option long_options[] = {
 	{"cellx",         required_argument, 0, 'x'},
@@ -27,11 +35,21 @@ static struct option long_options[] = {
 	{"noio",          no_argument,       0, 'n'},
 	{"output",        required_argument, 0, 'o'},
 	{"checkpoint",    no_argument,       0, 'c'},	
+	{"half-shell",    no_argument,       0, 'N'},
+	{"skin",          required_argument, 0, 'S'},
+	{"kernel",        required_argument, 0, 'k'},
+	{"mixed",         no_argument,       0, 'm'},
+	{"potential",     required_argument, 0, 'P'},
+	{"table",         required_argument, 0, 'T'},
+	{"order",         required_argument, 0, 'O'},
+	{"rng",           required_argument, 0, 'R'},
+	{"fused",         no_argument,       0, 'F'},
+	{"split",         required_argument, 0, 'K'},
     {"verbose",       no_argument,       0, 'v'},
     {"help",          no_argument,       0, 'h'},
 	{0, 0, 0, 0}
 };
-#define GETOPTS "x:y:p:s:r:t:i:d:f:e:no:cvh"
+#define GETOPTS "x:y:p:s:r:t:i:d:f:e:no:cNS:k:mP:T:O:R:FK:vh"
 
 /**
  * @brief Print a help message
@@ -39,14 +57,14 @@ static struct option long_options[] = {
  * @param progname The name of the current application
  */
 void print_help(char *progname) {
-	fprintf(stderr, "A simple molecular dynamics simulation using the Lennard-Jones potential and cell lists.\n\n");
+	fprintf(stderr, "A simple molecular dynamics simulation using short-ranged pair potentials and cell lists.\n\n");
 	fprintf(stderr, "Usage: %s [options]\n", progname);
 	fprintf(stderr, "Options and arguments:\n");
 	fprintf(stderr, "  -x N, --cellx=N         Cells in X-dimension\n");
 	fprintf(stderr, "  -y N, --celly=N         Cells in Y-dimension\n");
 	fprintf(stderr, "  -p N, --parts-per-dim=N Set the number of particles per cell, per dimension\n");
 	fprintf(stderr, "  -s N, --cellsize=N      Size of each cell in each dimension\n");
-	fprintf(stderr, "  -r N, --cutoff=N        Set the cut off size (must be smaller than cell size)\n");
+	fprintf(stderr, "  -r N, --cutoff=N        Set the cut off size (must be smaller than %d split cells)\n", MAX_HALO);
 	fprintf(stderr, "  -t N, --endtime=N       Set the end time\n");
 	fprintf(stderr, "  -i, --iters=N           Set the number of iterations\n");
     fprintf(stderr, "  -d, --del-t=DELT        Set the simulation timestep size\n");
@@ -55,6 +73,16 @@ void print_help(char *progname) {
 	fprintf(stderr, "  -n, --noio              Disable file I/O\n");
 	fprintf(stderr, "  -o FILE, --output=FILE  Set base filename for particle output (final output will be in BASENAME.vtp)\n");
 	fprintf(stderr, "  -c, --checkpoint        Enable checkpointing, checkpoints will be in BASENAME-ITERATION.vtp\n");
+	fprintf(stderr, "  -N, --half-shell        Use a half-shell stencil, evaluating each pair once (Newton's third law)\n");
+	fprintf(stderr, "  -S N, --skin=N          Use Verlet neighbour lists, with a skin of N added to the cut off\n");
+	fprintf(stderr, "  -k K, --kernel=K        Set the force kernel (scalar, avx2 or avx512), by default the widest supported\n");
+	fprintf(stderr, "  -m, --mixed             Use mixed precision (single precision pair forces, double precision integration and energies)\n");
+	fprintf(stderr, "  -P P, --potential=P     Set the pair potential (lj, wca, morse or soft), by default lj\n");
+	fprintf(stderr, "  -T T, --table=T         Evaluate the potential from a table (linear or cubic), always used for potentials other than lj\n");
+	fprintf(stderr, "  -O O, --order=O         Store and visit the cells in row, morton or hilbert order, by default row\n");
+	fprintf(stderr, "  -R G, --rng=G           Set the generator for the initial velocities (philox, or rand to match the serial codes), by default philox\n");
+	fprintf(stderr, "  -F, --fused             Use the fused integrator (kick, drift and cell check in one pass, and the second kick in the force loop)\n");
+	fprintf(stderr, "  -K N, --split=N         Split each cell into NxN smaller cells, searching only those within the cut off\n");
 	fprintf(stderr, "  -v, --verbose           Set verbose output\n");
 	fprintf(stderr, "  -h, --help              Print this message and exit\n");
 	fprintf(stderr, "\n");
@@ -112,6 +140,66 @@ void parse_args(int argc, char *argv[]) {
 			case 'c':
 				enable_checkpoints = 1;
 				break;
+			case 'N':
+				half_shell = 1;
+				break;
+			case 'S':
+				skin = atof(optarg);
+				break;
+			case 'k':
+				kernel = parse_kernel(optarg);
+				if (kernel < 0) {
+					fprintf(stderr, "Error: Unknown kernel %s.\n", optarg);
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'm':
+				mixed_precision = 1;
+				break;
+			case 'F':
+				fused = 1;
+				break;
+			case 'K':
+				split = atoi(optarg);
+				if (split < 1) {
+					fprintf(stderr, "Error: Cells must be split into at least 1 cell per dimension.\n");
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'P':
+				potential = parse_potential(optarg);
+				if (potential < 0) {
+					fprintf(stderr, "Error: Unknown potential %s.\n", optarg);
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'O':
+				cell_ordering = parse_ordering(optarg);
+				if (cell_ordering < 0) {
+					fprintf(stderr, "Error: Unknown cell ordering %s.\n", optarg);
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'R':
+				rng = parse_rng(optarg);
+				if (rng < 0) {
+					fprintf(stderr, "Error: Unknown generator %s.\n", optarg);
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'T':
+				table_type = parse_table_type(optarg);
+				if (table_type < 0) {
+					fprintf(stderr, "Error: Unknown table type %s.\n", optarg);
+					print_help(argv[0]);
+					exit(1);
+				}
+				break;
 			case 'v':
 				verbose = 1;
 				break;
@@ -122,8 +210,29 @@ void parse_args(int argc, char *argv[]) {
         }
     }
 
-	if (r_cut_off > cell_size) {
-		fprintf(stderr, "Error: The cell size must be greater than or equal to the cut off distance.\n");
+	// only Lennard-Jones (and WCA, its cut off form) has analytic kernels, and some potentials have their own cut off
+	if ((potential != POTENTIAL_LJ) && (potential != POTENTIAL_WCA) && (table_type == TABLE_NONE)) {
+		table_type = TABLE_CUBIC;
+	}
+	if (potential_cut_off(potential) > 0.0) {
+		r_cut_off = potential_cut_off(potential);
+	}
+
+	if (mixed_precision && (table_type != TABLE_NONE)) {
+		fprintf(stderr, "Error: Mixed precision is only available with the analytic Lennard-Jones kernels.\n");
+		print_help(argv[0]);
+		exit(1);
+	}
+
+	// the ghost cells (and the stencil) can only be MAX_HALO cells deep
+	if (r_cut_off + skin > MAX_HALO * cell_size / split) {
+		fprintf(stderr, "Error: The cut off distance plus the skin must be within %d (split) cells.\n", MAX_HALO);
+		print_help(argv[0]);
+		exit(1);
+	}
+
+	if (half_shell && ((x < 3) || (y < 3))) {
+		fprintf(stderr, "Error: The half-shell stencil needs at least 3 cells in each dimension.\n");
 		print_help(argv[0]);
 		exit(1);
 	}
@@ -148,5 +257,16 @@ void print_opts() {
 	printf("  noio             = %14d\n", no_output);
 	printf("  output           = %s\n", get_basename());
 	printf("  checkpoint       = %14d\n", enable_checkpoints);	
+	printf("  half-shell       = %14d\n", half_shell);
+	printf("  skin             = %14.12f\n", skin);
+	printf("  kernel           = %14s\n", kernel_name(kernel));
+	printf("  mixed            = %14d\n", mixed_precision);
+	printf("  potential        = %14s\n", potential_name(potential));
+	printf("  table            = %14s\n", table_type_name(table_type));
+	printf("  order            = %14s\n", ordering_name(cell_ordering));
+	printf("  rng              = %14s\n", rng_name(rng));
+	printf("  fused            = %14d\n", fused);
+	printf("  split            = %14d\n", split);
+	printf("  halo             = %14d\n", halo);
     printf("=======================================\n");
 }
\ No newline at end of file
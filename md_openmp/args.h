@@ -5,6 +5,9 @@ extern int verbose;
 extern int no_output;
 extern int output_freq;
 extern int enable_checkpoints;
+extern int half_shell;
+extern int mixed_precision;
+extern int fused;
 extern int fixed_dt;
 
 void parse_args(int argc, char *argv[]);
@@ -1,23 +1,125 @@
-
 #include "boundary.h"
 #include "data.h"
 
 /**
- * @brief Apply the boundary conditions. This effectively points the ghost cell areas
- *        to the same cell list as the opposite edge (i.e. wraps the domain).
- *        This has to be done after every cell list update, just to ensure that a destructive
- *        operations hasn't broken things.
- * 
+ * @brief Copy the positions of the particles in one cell to another (with the same number of particles)
+ *
+ * @param dst The cell to copy to
+ * @param src The cell to copy from
+ */
+static inline void copy_cell(struct cell_list * dst, struct cell_list * src) {
+	for (int k = 0; k < dst->count; k++) {
+		parts.x[dst->start + k] = parts.x[src->start + k];
+		parts.y[dst->start + k] = parts.y[src->start + k];
+	}
+}
+
+/**
+ * @brief Add the accelerations of the particles in one cell on to those of another (with the same number of particles)
+ *
+ * @param dst The cell to add to
+ * @param src The cell to add from
+ */
+static inline void fold_cell(struct cell_list * dst, struct cell_list * src) {
+	for (int k = 0; k < dst->count; k++) {
+		parts.ax[dst->start + k] += parts.ax[src->start + k];
+		parts.ay[dst->start + k] += parts.ay[src->start + k];
+	}
+}
+
+/**
+ * @brief Apply the boundary conditions. The ghost cells hold their own copies of the particles in the cells on the
+ *        opposite edge (i.e. wrap the domain), stored after the real particles in the particle arrays. The ghost
+ *        cells are halo cells deep, so that the stencil can reach them from every cell. Positions are relative to
+ *        their cell, so the copies need no shifting. This lays out the ghost cells (which has to be done after
+ *        every cell list update, since the number of particles in each cell may have changed), then copies the
+ *        positions in (as update_halo). This is called from within the parallel region.
+ *
  */
 void apply_boundary() {
-	// Apply boundary conditions
+	// lay out the ghost cells, in the same order as they are copied (the columns either side, then the
+	// rows above and below, including the corners, which are copies of the ghost columns)
+	#pragma omp single
+	{
+		int next = num_particles;
+		for (int j = 1; j < y+1; j++) {
+			for (int g = 0; g < halo; g++) {
+				cells[-g][j].start = next;
+				cells[-g][j].count = cells[x-g][j].count;
+				next += cells[-g][j].count;
+				cells[x+1+g][j].start = next;
+				cells[x+1+g][j].count = cells[1+g][j].count;
+				next += cells[x+1+g][j].count;
+			}
+		}
+		for (int i = 1-halo; i < x+1+halo; i++) {
+			for (int g = 0; g < halo; g++) {
+				cells[i][-g].start = next;
+				cells[i][-g].count = cells[i][y-g].count;
+				next += cells[i][-g].count;
+				cells[i][y+1+g].start = next;
+				cells[i][y+1+g].count = cells[i][1+g].count;
+				next += cells[i][y+1+g].count;
+			}
+		}
+		num_ghosts = next - num_particles;
+
+		// make room for the copies (with some to spare, so this is rare)
+		if (next > parts.capacity) {
+			reserve_particle_data(&parts, next + num_ghosts / 4);
+		}
+	}
+
+	update_halo();
+}
+
+/**
+ * @brief Refresh the positions of the particles in the ghost cells from the cells they are copies of. This has
+ *        to be done whenever the particles have moved (but the ghost cells are still laid out the same).
+ *        This is called from within the parallel region (the second loop copies the corners from the first,
+ *        so it waits for it to finish).
+ *
+ */
+void update_halo() {
+	#pragma omp for schedule(static)
 	for (int j = 1; j < y+1; j++) {
-		cells[0][j].head = cells[x][j].head;
-		cells[x+1][j].head = cells[1][j].head;
+		for (int g = 0; g < halo; g++) {
+			copy_cell(&(cells[-g][j]), &(cells[x-g][j]));
+			copy_cell(&(cells[x+1+g][j]), &(cells[1+g][j]));
+		}
+	}
+
+	#pragma omp for schedule(static)
+	for (int i = 1-halo; i < x+1+halo; i++) {
+		for (int g = 0; g < halo; g++) {
+			copy_cell(&(cells[i][-g]), &(cells[i][y-g]));
+			copy_cell(&(cells[i][y+1+g]), &(cells[i][1+g]));
+		}
 	}
+}
 
-	for (int i = 0; i < x+2; i++) {
-		cells[i][0].head = cells[i][y].head;
-		cells[i][y+1].head = cells[i][1].head;
+/**
+ * @brief Add the accelerations of the particles in the ghost cells back on to the particles they are copies of
+ *        (with the half-shell stencil, pairs across the boundary add to the copies). This runs the copies of
+ *        update_halo backwards, so the corners are added to the ghost columns before those are added to the
+ *        real cells. Each loop iteration only adds to its own column (or row), so the order of the additions
+ *        doesn't depend on the number of threads. This is called from within the parallel region.
+ *
+ */
+void fold_halo() {
+	#pragma omp for schedule(static)
+	for (int i = 1-halo; i < x+1+halo; i++) {
+		for (int g = 0; g < halo; g++) {
+			fold_cell(&(cells[i][y-g]), &(cells[i][-g]));
+			fold_cell(&(cells[i][1+g]), &(cells[i][y+1+g]));
+		}
+	}
+
+	#pragma omp for schedule(static)
+	for (int j = 1; j < y+1; j++) {
+		for (int g = 0; g < halo; g++) {
+			fold_cell(&(cells[x-g][j]), &(cells[-g][j]));
+			fold_cell(&(cells[1+g][j]), &(cells[x+1+g][j]));
+		}
 	}
-}
\ No newline at end of file
+}
@@ -2,5 +2,7 @@
 #define BOUNDARY_H
 
 void apply_boundary();
+void update_halo();
+void fold_halo();
 
-#endif
\ No newline at end of file
+#endif
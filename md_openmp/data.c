@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <omp.h>
 
 #include "data.h"
+#include "order.h"
 
 // parameters for end time, cut off, cell size, grid size and number of particles
 double t_end = 0.5;
@@ -13,6 +17,16 @@ int x = 500;
 int y = 500;
 int num_particles;
 
+// the number of copies of particles in the ghost cells (which come after the real particles)
+int num_ghosts = 0;
+
+// the number of cells each cell is split into (per dimension), and how many cells deep the ghost cells are
+int split = 1;
+int halo = 1;
+
+// skin added to the cut off for the neighbour lists (if 0, neighbour lists are not used)
+double skin = 0.0;
+
 // number of iterations, timestep duration and half-timestep duration
 int niters = 1000;
 double dt;
@@ -44,71 +58,449 @@ int num_part_per_dim = 2;
 // the cell list
 struct cell_list ** cells;
 
+// the particle data
+struct particle_data parts;
+
+// scratch space used to reorder the particle arrays when sorting by cell
+static int * sort_index = NULL;
+static double * sort_scratch = NULL;
+static int * sort_scratch_id = NULL;
+
+// a list of the particles leaving the cells handled by one thread (and space to merge a cell's particles)
+struct outbox {
+	int * part;
+	int count;
+	int capacity;
+	int * merge;
+	int num_merge;
+	int merge_capacity;
+};
+
+// migration scratch space: an outbox for each thread, and for each cell, the thread whose outbox holds the
+// particles leaving it, where they start in that outbox and how many there are, then the new start and count
+static struct outbox * outboxes = NULL;
+static int * out_thread = NULL;
+static int * out_first = NULL;
+static int * out_count = NULL;
+static int * new_start = NULL;
+static int * new_count = NULL;
+static int * block_sum = NULL;
+
+// alignment of each array in an arena (a cache line, which also suits the widest vector loads)
+#define ARENA_ALIGN 64
+
+// size of a huge page (arenas at least this big are aligned to it, so they can be backed by huge pages)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 /**
- * @brief Add a particle to a particular cell list
+ * @brief Set up an arena. Large arenas are aligned to, and rounded up to, the huge page size, and
+ *        the kernel is asked to back them with huge pages where it can.
  * 
- * @param list The cell list to add the particle to
- * @param particle The particle
+ * @param a The arena
+ * @param size The total size of the arrays to be allocated from it (including their alignment)
  */
-void add_particle(struct cell_list * list, struct particle_t * particle) {
-	//moved to outside if else statement as they both set particle->prev to NULL
-	particle->prev = NULL;
-	if (list->head != NULL) {
-		list->head->prev = particle;
-		particle->next = list->head;
-	} else {
-		particle->next = NULL;
+void arena_init(struct arena * a, size_t size) {
+	size_t align = (size >= HUGE_PAGE_SIZE) ? HUGE_PAGE_SIZE : ARENA_ALIGN;
+	size = (size + align - 1) / align * align;
+
+	void * base;
+	if (posix_memalign(&base, align, size) != 0) {
+		fprintf(stderr, "Error: Unable to allocate %zu bytes for the particle data.\n", size);
+		exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	if (align == HUGE_PAGE_SIZE) {
+		madvise(base, size, MADV_HUGEPAGE);
 	}
+#endif
 
-	list->head = particle;
+	a->base = (char *) base;
+	a->size = size;
+	a->used = 0;
 }
 
 /**
- * @brief Remove a particle from a particular cell list
+ * @brief Hand out the next array from an arena
  * 
- * @param list The cell list to remove the particle from
- * @param particle The particle
+ * @param a The arena
+ * @param size The size of the array
+ * @return void* The array (aligned to ARENA_ALIGN)
  */
-void remove_particle(struct cell_list * list, struct particle_t * particle) {
-	if (list->head == particle) {
-		list->head = particle->next;
+void * arena_alloc(struct arena * a, size_t size) {
+	size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (a->used + size > a->size) {
+		fprintf(stderr, "Error: Arena of %zu bytes is full.\n", a->size);
+		exit(1);
 	}
+	void * p = a->base + a->used;
+	a->used += size;
+	return p;
+}
+
+/**
+ * @brief Free an arena, and every array handed out from it
+ * 
+ * @param a The arena
+ */
+void arena_free(struct arena * a) {
+	free(a->base);
+	a->base = NULL;
+	a->size = 0;
+	a->used = 0;
+}
+
+/**
+ * @brief Allocate the arrays for a set of particle data (and the scratch space used to sort it) from
+ *        a single arena. The memory is first touched in parallel, so that on a NUMA system each page
+ *        is placed near the thread that will work on it.
+ * 
+ * @param data The particle data to allocate
+ * @param n The number of particles (real and ghost) to make room for
+ */
+void alloc_particle_data(struct particle_data * data, int n) {
+	size_t doubles = ((n * sizeof(double) + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN;
+	size_t ints = ((n * sizeof(int) + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN;
+	arena_init(&(data->arena), 7 * doubles + 3 * ints);
+
+	data->x = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->y = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->ax = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->ay = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->vx = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->vy = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	data->part_id = (int *) arena_alloc(&(data->arena), n * sizeof(int));
+
+	sort_scratch = (double *) arena_alloc(&(data->arena), n * sizeof(double));
+	sort_index = (int *) arena_alloc(&(data->arena), n * sizeof(int));
+	sort_scratch_id = (int *) arena_alloc(&(data->arena), n * sizeof(int));
+	data->capacity = n;
 
-	if (particle->prev != NULL) {
-		particle->prev->next = particle->next;
+	char * base = data->arena.base;
+	#pragma omp parallel for schedule(static)
+	for (size_t b = 0; b < data->arena.size; b += 4096) {
+		size_t len = (data->arena.size - b < 4096) ? data->arena.size - b : 4096;
+		memset(base + b, 0, len);
 	}
+}
+
+/**
+ * @brief Free the arrays for a set of particle data (and the scratch space used to sort it)
+ * 
+ * @param data The particle data to free
+ */
+void free_particle_data(struct particle_data * data) {
+	arena_free(&(data->arena));
+	data->x = data->y = NULL;
+	data->ax = data->ay = NULL;
+	data->vx = data->vy = NULL;
+	data->part_id = NULL;
+	data->capacity = 0;
+
+	sort_index = NULL;
+	sort_scratch = NULL;
+	sort_scratch_id = NULL;
 
-	if (particle->next != NULL) {
-		particle->next->prev = particle->prev;
+	if (outboxes != NULL) {
+		for (int t = 0; t < omp_get_max_threads(); t++) {
+			free(outboxes[t].part);
+			free(outboxes[t].merge);
+		}
+		free(outboxes);
+		free(out_thread);
+		free(out_first);
+		free(out_count);
+		free(new_start);
+		free(new_count);
+		free(block_sum);
+		outboxes = NULL;
+	}
+}
+
+/**
+ * @brief Make room for more particles (i.e. for more copies in the ghost cells), keeping the data of the real
+ *        particles. This moves every array, so it must be called by a single thread.
+ * 
+ * @param data The particle data
+ * @param capacity The number of particles (real and ghost) to make room for
+ */
+void reserve_particle_data(struct particle_data * data, int capacity) {
+	if (capacity <= data->capacity) {
+		return;
 	}
 
-	particle->next = NULL;
-	particle->prev = NULL;
+	struct particle_data old = *data;
+	alloc_particle_data(data, capacity);
+	memcpy(data->x, old.x, num_particles * sizeof(double));
+	memcpy(data->y, old.y, num_particles * sizeof(double));
+	memcpy(data->ax, old.ax, num_particles * sizeof(double));
+	memcpy(data->ay, old.ay, num_particles * sizeof(double));
+	memcpy(data->vx, old.vx, num_particles * sizeof(double));
+	memcpy(data->vy, old.vy, num_particles * sizeof(double));
+	memcpy(data->part_id, old.part_id, num_particles * sizeof(int));
+	arena_free(&(old.arena));
 }
 
 /**
- * @brief Allocate a 2D array of cell list structures
+ * @brief Move each element of an array to its new index (as given by sort_index)
  * 
- * @param m Dimension in X direction
- * @param n Dimension in Y direction
- * @return struct cell_list** An allocated 2D cell list structure
+ * @param array The array to reorder, which is swapped with the scratch array
  */
-struct cell_list ** alloc_2d_cell_list_array(int m, int n) {
-  	struct cell_list ** x;
-
-  	x = (struct cell_list **) malloc(m * sizeof(struct cell_list));
-  	x[0] = (struct cell_list *) calloc(m * n, sizeof(struct cell_list));
-  	for (int i = 1; i < m; i++)
-    	x[i] = &x[0][i*n];
-	return x;
+static void permute_array(double ** array) {
+	double * src = *array;
+	#pragma omp for schedule(static)
+	for (int k = 0; k < num_particles; k++) {
+		sort_scratch[sort_index[k]] = src[k];
+	}
+	#pragma omp single
+	{
+		*array = sort_scratch;
+		sort_scratch = src;
+	}
 }
 
 /**
- * @brief Free a 2D array
+ * @brief Make sure the migration scratch space is allocated (the outboxes, and the per-cell arrays)
  * 
- * @param array The 2D array to free
  */
-void free_2d_array(void ** array) {
-	free(array[0]);
-	free(array);
-}
\ No newline at end of file
+static void alloc_migration() {
+	if (outboxes != NULL) {
+		return;
+	}
+	int num_cells = (x+2*halo) * (y+2*halo);
+	outboxes = (struct outbox *) calloc(omp_get_max_threads(), sizeof(struct outbox));
+	out_thread = (int *) malloc(num_cells * sizeof(int));
+	out_first = (int *) malloc(num_cells * sizeof(int));
+	out_count = (int *) malloc(num_cells * sizeof(int));
+	new_start = (int *) malloc(num_cells * sizeof(int));
+	new_count = (int *) malloc(num_cells * sizeof(int));
+	block_sum = (int *) malloc((omp_get_max_threads() + 1) * sizeof(int));
+}
+
+/**
+ * @brief Add an entry to a growable list of ints
+ * 
+ * @param list The list
+ * @param count The number of entries in the list
+ * @param capacity The capacity of the list
+ * @param value The entry to add
+ */
+static inline void push_int(int ** list, int * count, int * capacity, int value) {
+	if (*count == *capacity) {
+		*capacity = (*capacity == 0) ? 64 : 2 * (*capacity);
+		*list = (int *) realloc(*list, *capacity * sizeof(int));
+	}
+	(*list)[(*count)++] = value;
+}
+
+/**
+ * @brief Get the distinct cells (other than a cell itself) that particles can arrive in it from, i.e.
+ *        its neighbours, wrapped around the periodic boundary
+ * 
+ * @param i The x index of the cell
+ * @param j The y index of the cell
+ * @param sources The (flattened) indices of the cells
+ * @return int The number of cells
+ */
+static int source_cells(int i, int j, int * sources) {
+	int self = i * (y+2*halo) + j;
+	int num = 0;
+	for (int a = -1; a <= 1; a++) {
+		for (int b = -1; b <= 1; b++) {
+			int si = i+a;
+			if (si == 0) { si = x; }
+			if (si == x+1) { si = 1; }
+			int sj = j+b;
+			if (sj == 0) { sj = y; }
+			if (sj == y+1) { sj = 1; }
+			int s = si * (y+2*halo) + sj;
+
+			// on small grids, the same cell can be a neighbour more than once
+			int seen = (s == self);
+			for (int k = 0; k < num; k++) {
+				seen |= (sources[k] == s);
+			}
+			if (!seen) {
+				sources[num++] = s;
+			}
+		}
+	}
+	return num;
+}
+
+/**
+ * @brief Reorder the particle data so that each cell's particles are contiguous again (with the
+ *        cells in the order given by cell_order), and rebuild the start and count of every cell.
+ *        Particles keep their relative order within a cell. Ghost cells are left empty, so the
+ *        boundary must be reapplied afterwards.
+ *        Accelerations are not carried over, since they are recomputed after every cell update.
+ * 
+ *        This runs in parallel, in two phases. First, each thread puts the particles leaving its
+ *        cells into its own outbox. Then each cell collects its arrivals from the outboxes of its
+ *        neighbours, so no two threads ever write to the same cell, and the result doesn't depend
+ *        on the number of threads. This is called from within the parallel region.
+ * 
+ * @param part_cell The (flattened) index of the cell each particle belongs in
+ */
+void sort_particles(int * part_cell) {
+	struct cell_list * flat_cells = cells[0];
+
+	#pragma omp single
+	alloc_migration();
+
+	int t = omp_get_thread_num();
+	int nt = omp_get_num_threads();
+	struct outbox * box = &(outboxes[t]);
+	box->count = 0;
+
+	// phase one: count the particles staying in each cell, and send the rest to the outbox
+	#pragma omp for schedule(static)
+	for (int n = 0; n < x * y; n++) {
+		int c = cell_order[n];
+		struct cell_list * cl = &(flat_cells[c]);
+		out_thread[c] = t;
+		out_first[c] = box->count;
+		new_count[c] = 0;
+		for (int p = cl->start; p < cl->start + cl->count; p++) {
+			if (part_cell[p] == c) {
+				new_count[c]++;
+			} else {
+				push_int(&(box->part), &(box->count), &(box->capacity), p);
+			}
+		}
+		out_count[c] = box->count - out_first[c];
+	}
+
+	// phase two: count the particles arriving in each cell from its neighbours' outboxes
+	#pragma omp for schedule(static)
+	for (int n = 0; n < x * y; n++) {
+		int c = cell_order[n];
+		int sources[8];
+		int num_sources = source_cells(c / (y+2*halo), c % (y+2*halo), sources);
+		for (int s = 0; s < num_sources; s++) {
+			int * out = &(outboxes[out_thread[sources[s]]].part[out_first[sources[s]]]);
+			for (int k = 0; k < out_count[sources[s]]; k++) {
+				new_count[c] += (part_cell[out[k]] == c);
+			}
+		}
+	}
+
+	// use a prefix sum (over a block of cells per thread, then over the blocks) to find where each cell starts
+	int lo = (int) (((long) x * y * t) / nt);
+	int hi = (int) (((long) x * y * (t+1)) / nt);
+	int sum = 0;
+	for (int n = lo; n < hi; n++) {
+		sum += new_count[cell_order[n]];
+	}
+	block_sum[t+1] = sum;
+	#pragma omp barrier
+	#pragma omp single
+	{
+		block_sum[0] = 0;
+		for (int b = 1; b <= nt; b++) {
+			block_sum[b] += block_sum[b-1];
+		}
+	}
+	int offset = block_sum[t];
+	for (int n = lo; n < hi; n++) {
+		new_start[cell_order[n]] = offset;
+		offset += new_count[cell_order[n]];
+	}
+	#pragma omp barrier
+
+	// work out the new index of each particle, keeping them in their original relative order
+	#pragma omp for schedule(static)
+	for (int n = 0; n < x * y; n++) {
+		int c = cell_order[n];
+		struct cell_list * cl = &(flat_cells[c]);
+		box->num_merge = 0;
+		for (int p = cl->start; p < cl->start + cl->count; p++) {
+			if (part_cell[p] == c) {
+				push_int(&(box->merge), &(box->num_merge), &(box->merge_capacity), p);
+			}
+		}
+		int sources[8];
+		int num_sources = source_cells(c / (y+2*halo), c % (y+2*halo), sources);
+		for (int s = 0; s < num_sources; s++) {
+			int * out = &(outboxes[out_thread[sources[s]]].part[out_first[sources[s]]]);
+			for (int k = 0; k < out_count[sources[s]]; k++) {
+				if (part_cell[out[k]] == c) {
+					push_int(&(box->merge), &(box->num_merge), &(box->merge_capacity), out[k]);
+				}
+			}
+		}
+
+		// only a few particles arrive in a cell, so an insertion sort puts them back in order
+		int * m = box->merge;
+		for (int k = 1; k < box->num_merge; k++) {
+			int p = m[k];
+			int l = k - 1;
+			for (; (l >= 0) && (m[l] > p); l--) {
+				m[l+1] = m[l];
+			}
+			m[l+1] = p;
+		}
+		for (int k = 0; k < box->num_merge; k++) {
+			sort_index[m[k]] = new_start[c] + k;
+		}
+	}
+
+	// finally update the cells (once every thread has finished with their old ranges)
+	#pragma omp for schedule(static)
+	for (int i = 1-halo; i < x+1+halo; i++) {
+		for (int j = 1-halo; j < y+1+halo; j++) {
+			int c = i * (y+2*halo) + j;
+			if ((i >= 1) && (i <= x) && (j >= 1) && (j <= y)) {
+				cells[i][j].start = new_start[c];
+				cells[i][j].count = new_count[c];
+			} else {
+				cells[i][j].start = 0;
+				cells[i][j].count = 0;
+			}
+		}
+	}
+
+	permute_array(&(parts.x));
+	permute_array(&(parts.y));
+	permute_array(&(parts.vx));
+	permute_array(&(parts.vy));
+
+	int * src_id = parts.part_id;
+	#pragma omp for schedule(static)
+	for (int k = 0; k < num_particles; k++) {
+		sort_scratch_id[sort_index[k]] = src_id[k];
+	}
+	#pragma omp single
+	{
+		parts.part_id = sort_scratch_id;
+		sort_scratch_id = src_id;
+	}
+}
+
+/**
+ * @brief Allocate the cells, with ghost cells halo cells deep around them. The interior cells are indexed
+ *        from 1 to x (and 1 to y) whatever the depth of the ghost cells, so the ghost cells run from 1-halo
+ *        to 0 and from x+1 to x+halo. A cell's flattened index (relative to cells[0][0]) is i * (y+2*halo) + j.
+ * 
+ * @return struct cell_list** The cells
+ */
+struct cell_list ** alloc_cells() {
+	int m = x + 2*halo;
+	int n = y + 2*halo;
+	struct cell_list ** rows = (struct cell_list **) malloc(m * sizeof(struct cell_list *));
+	struct cell_list * flat = (struct cell_list *) calloc(m * n, sizeof(struct cell_list));
+	for (int r = 0; r < m; r++) {
+		rows[r] = &flat[r*n + (halo-1)];
+	}
+	return &rows[halo-1];
+}
+
+/**
+ * @brief Free the cells allocated by alloc_cells
+ * 
+ * @param array The cells
+ */
+void free_cells(struct cell_list ** array) {
+	free(&array[1-halo][1-halo]);
+	free(&array[1-halo]);
+}
+
@@ -1,19 +1,30 @@
 #ifndef DATA_H
 #define DATA_H
 
-// particle data type (with pointers to next and previous for linked list)
-struct particle_t {
-	double x, y; // position within cell
-	double ax, ay; // acceleration
-	double vx, vy; // velocity
-	struct particle_t * next;
-	struct particle_t * prev;
-	int part_id;
+#include <stddef.h>
+
+// a single block of memory that arrays are handed out from in turn (so they are contiguous, aligned and freed together)
+struct arena {
+	char * base;
+	size_t size;
+	size_t used;
+};
+
+// particle data, stored as a structure of arrays sorted by cell (so each cell's particles are contiguous),
+// followed by the copies of the particles in the ghost cells
+struct particle_data {
+	double * x, * y; // position within cell
+	double * ax, * ay; // acceleration
+	double * vx, * vy; // velocity
+	int * part_id;
+	int capacity; // the number of particles (real and ghost) there is room for
+	struct arena arena; // the memory all of the arrays (and the scratch space used to sort them) are in
 };
 
-// list for a cell, with a head
+// list for a cell, given as the range of its particles within the particle arrays
 struct cell_list {
-	struct particle_t * head;
+	int start;
+	int count;
 };
 
 // parameters for end time, cut off, cell size, grid size and number of particles
@@ -24,6 +35,16 @@ extern int x;
 extern int y;
 extern int num_particles;
 
+// the number of copies of particles in the ghost cells (which come after the real particles)
+extern int num_ghosts;
+
+// the number of cells each cell is split into (per dimension), and how many cells deep the ghost cells are
+extern int split;
+extern int halo;
+
+// skin added to the cut off for the neighbour lists (if 0, neighbour lists are not used)
+extern double skin;
+
 // number of iterations, timestep duration and half-timestep duration
 extern int niters;
 extern double dt;
@@ -48,9 +69,17 @@ extern int num_part_per_dim;
 // the cell list
 extern struct cell_list ** cells;
 
-void add_particle(struct cell_list * list, struct particle_t * particle);
-void remove_particle(struct cell_list * list, struct particle_t * particle);
-struct cell_list ** alloc_2d_cell_list_array(int m, int n);
-void free_2d_array(void ** array);
+// the particle data
+extern struct particle_data parts;
+
+void arena_init(struct arena * a, size_t size);
+void * arena_alloc(struct arena * a, size_t size);
+void arena_free(struct arena * a);
+void alloc_particle_data(struct particle_data * data, int n);
+void free_particle_data(struct particle_data * data);
+void reserve_particle_data(struct particle_data * data, int capacity);
+void sort_particles(int * part_cell);
+struct cell_list ** alloc_cells();
+void free_cells(struct cell_list ** array);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "args.h"
+#include "kernel.h"
+#include "data.h"
+#include "neighbour.h"
+#include "potential.h"
+#include "pair.h"
+
+// the requested kernel (which is replaced by the chosen kernel in select_kernel)
+int kernel = KERNEL_AUTO;
+
+// the chosen kernels
+range_kernel_t range_kernel;
+list_kernel_t list_kernel;
+
+// the forces-only versions of the chosen kernels (for steps where the energy isn't reported)
+range_kernel_t range_force_kernel;
+list_kernel_t list_force_kernel;
+
+// a neighbourhood for each thread
+static struct neighbourhood * thread_neighbourhoods;
+
+// the constants used to evaluate a pair in single precision
+struct pair_constants_f {
+	float r_cut_off;
+	float r_cut_off_2;
+	float Uc;
+	float Duc;
+};
+
+// single precision copies of the constants (for the mixed precision kernels)
+static struct pair_constants_f constants_f;
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, one pair at a time
+ *
+ * @param px The x position of the particle (relative to the neighbourhood's centre cell)
+ * @param py The y position of the particle (relative to the neighbourhood's centre cell)
+ * @param nh The neighbourhood
+ * @param first The first entry to evaluate against
+ * @param skip A particle to skip (i.e. the particle itself), or -1
+ * @param newton Whether to apply the opposite acceleration to the entries
+ * @param ax The x acceleration of the particle
+ * @param ay The y acceleration of the particle
+ * @param energy The potential energy
+ * @param form The form of pair evaluation (a constant, so each use of this is specialised)
+ * @param with_energy Whether to calculate the potential energy (a constant, the forces-only kernels leave it alone)
+ */
+static inline __attribute__((always_inline)) void range_scalar(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	double p_ax = *ax;
+	double p_ay = *ay;
+	double pot_energy = *energy;
+	for (int k = first; k < nh->count; k++) {
+		if (nh->index[k] == skip) {
+			continue;
+		}
+		evaluate_pair(form, c, px - nh->x[k], py - nh->y[k], newton, &p_ax, &p_ay, &(nh->ax[k]), &(nh->ay[k]), &pot_energy, with_energy);
+	}
+	*ax = p_ax;
+	*ay = p_ay;
+	*energy = pot_energy;
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, one pair at a time
+ *
+ * @param px The x position of the particle (relative to its cell)
+ * @param py The y position of the particle (relative to its cell)
+ * @param index The neighbouring particles
+ * @param shift The cell shift of each neighbour
+ * @param num The number of neighbours
+ * @param newton Whether to apply the opposite acceleration to the neighbours
+ * @param ax The x acceleration of the particle
+ * @param ay The y acceleration of the particle
+ * @param energy The potential energy
+ * @param form The form of pair evaluation
+ * @param with_energy Whether to calculate the potential energy
+ */
+static inline __attribute__((always_inline)) void list_scalar(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	double p_ax = *ax;
+	double p_ay = *ay;
+	double pot_energy = *energy;
+	for (int k = 0; k < num; k++) {
+		int q = index[k];
+		evaluate_pair(form, c, px - parts.x[q] + nbrs.shift_x[shift[k]], py - parts.y[q] + nbrs.shift_y[shift[k]], newton, &p_ax, &p_ay, &(parts.ax[q]), &(parts.ay[q]), &pot_energy, with_energy);
+	}
+	*ax = p_ax;
+	*ay = p_ay;
+	*energy = pot_energy;
+}
+
+DEFINE_KERNELS_SCALAR(, PAIR_LJ)
+DEFINE_KERNELS_SCALAR(_default, PAIR_LJ_DEFAULT)
+DEFINE_KERNELS_SCALAR(_wca, PAIR_WCA)
+DEFINE_KERNELS_SCALAR(_table, PAIR_TABLE)
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for a single pair in single precision (for the mixed
+ *        precision kernels). The potential energy is still accumulated in double precision.
+ *
+ * @param c The constants of the potential
+ * @param dx The distance between the particles in x
+ * @param dy The distance between the particles in y
+ * @param energy The potential energy
+ * @param with_energy Whether to calculate the potential energy
+ * @return float The force divided by the distance (or 0 if the pair is outside the cut off)
+ */
+static inline __attribute__((always_inline)) float lj_pair_f(const struct pair_constants_f c, float dx, float dy, double * energy, const int with_energy) {
+	float r_2 = dx*dx + dy*dy;
+	if (r_2 < c.r_cut_off_2) {
+		float r_2_inv = 1.0f / r_2;
+		float r_6_inv = r_2_inv * r_2_inv * r_2_inv;
+
+		if (with_energy) {
+			*energy += (double) (4.0f * r_6_inv * (r_6_inv - 1.0f) - c.Uc - c.Duc * (sqrtf(r_2) - c.r_cut_off));
+		}
+		return (48.0f * r_2_inv * r_6_inv * (r_6_inv - 0.5f));
+	}
+	return 0.0f;
+}
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, one pair at a time in single precision
+ *        (see range_kernel_scalar)
+ */
+static inline __attribute__((always_inline)) void range_scalar_f(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	float p_x = (float) px;
+	float p_y = (float) py;
+	float p_ax = 0.0f;
+	float p_ay = 0.0f;
+	double pot_energy = *energy;
+	for (int k = first; k < nh->count; k++) {
+		if (nh->index[k] == skip) {
+			continue;
+		}
+		float dx = p_x - nh->xf[k];
+		float dy = p_y - nh->yf[k];
+		float f = lj_pair_f(c, dx, dy, &pot_energy, with_energy);
+		p_ax += f*dx;
+		p_ay += f*dy;
+		if (newton) {
+			nh->axf[k] -= f*dx;
+			nh->ayf[k] -= f*dy;
+		}
+	}
+	*ax += p_ax;
+	*ay += p_ay;
+	*energy = pot_energy;
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, one pair at a time in single
+ *        precision (see list_kernel_scalar)
+ */
+static inline __attribute__((always_inline)) void list_scalar_f(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	float p_x = (float) px;
+	float p_y = (float) py;
+	float p_ax = 0.0f;
+	float p_ay = 0.0f;
+	double pot_energy = *energy;
+	for (int k = 0; k < num; k++) {
+		int q = index[k];
+		float dx = p_x - nbrs.xf[q] + nbrs.shift_xf[shift[k]];
+		float dy = p_y - nbrs.yf[q] + nbrs.shift_yf[shift[k]];
+		float f = lj_pair_f(c, dx, dy, &pot_energy, with_energy);
+		p_ax += f*dx;
+		p_ay += f*dy;
+		if (newton && (f != 0.0f)) {
+			parts.ax[q] -= f*dx;
+			parts.ay[q] -= f*dy;
+		}
+	}
+	*ax += p_ax;
+	*ay += p_ay;
+	*energy = pot_energy;
+}
+
+/**
+ * @brief Define the single precision kernels for an instruction set, with and without the energy (as with
+ *        DEFINE_KERNELS_SCALAR)
+ */
+#define DEFINE_KERNELS_F(isa, attributes) \
+	attributes static void range_kernel_##isa##_f(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_##isa##_f(px, py, nh, first, skip, newton, ax, ay, energy, 1); \
+	} \
+	attributes static void range_forces_##isa##_f(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_##isa##_f(px, py, nh, first, skip, newton, ax, ay, energy, 0); \
+	} \
+	attributes static void list_kernel_##isa##_f(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_##isa##_f(px, py, index, shift, num, newton, ax, ay, energy, 1); \
+	} \
+	attributes static void list_forces_##isa##_f(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_##isa##_f(px, py, index, shift, num, newton, ax, ay, energy, 0); \
+	}
+
+DEFINE_KERNELS_F(scalar, )
+
+#ifdef __x86_64__
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for four pairs at once. Pairs outside of the mask have
+ *        their force and energy set to zero.
+ *
+ * @param c The constants of the potential
+ * @param dx The distances in x
+ * @param dy The distances in y
+ * @param r_2 The squared distances
+ * @param mask The pairs to evaluate (i.e. those within the cut off)
+ * @param fx The resulting x accelerations
+ * @param fy The resulting y accelerations
+ * @param energy The resulting potential energies
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void lj_avx2(const struct pair_constants c, __m256d dx, __m256d dy, __m256d r_2, __m256d mask, __m256d * fx, __m256d * fy, __m256d * energy, const int with_energy) {
+	__m256d r_2_inv = _mm256_div_pd(_mm256_set1_pd(1.0), r_2);
+	__m256d r_6_inv = _mm256_mul_pd(_mm256_mul_pd(r_2_inv, r_2_inv), r_2_inv);
+
+	__m256d f = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(48.0), _mm256_mul_pd(r_2_inv, r_6_inv)), _mm256_sub_pd(r_6_inv, _mm256_set1_pd(0.5)));
+	f = _mm256_and_pd(f, mask);
+	*fx = _mm256_mul_pd(f, dx);
+	*fy = _mm256_mul_pd(f, dy);
+
+	if (with_energy) {
+		__m256d u = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(4.0), r_6_inv), _mm256_sub_pd(r_6_inv, _mm256_set1_pd(1.0)));
+		u = _mm256_sub_pd(u, _mm256_set1_pd(c.Uc));
+		u = _mm256_fnmadd_pd(_mm256_set1_pd(c.Duc), _mm256_sub_pd(_mm256_sqrt_pd(r_2), _mm256_set1_pd(c.r_cut_off)), u);
+		*energy = _mm256_and_pd(u, mask);
+	}
+}
+
+/**
+ * @brief Evaluate the tabulated potential for four pairs at once (see lj_avx2), gathering the coefficients
+ *        of each pair's interval from the table
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void table_avx2(const struct pair_constants c, __m256d dx, __m256d dy, __m256d r_2, __m256d mask, __m256d * fx, __m256d * fy, __m256d * energy, const int with_energy) {
+	__m256d s = _mm256_mul_pd(_mm256_sub_pd(r_2, _mm256_set1_pd(c.table_r_2_min)), _mm256_set1_pd(c.table_inv_dr_2));
+	__m128i i = _mm256_cvttpd_epi32(s);
+	i = _mm_min_epi32(_mm_max_epi32(i, _mm_setzero_si128()), _mm_set1_epi32(TABLE_SIZE - 1));
+	__m256d t = _mm256_sub_pd(s, _mm256_cvtepi32_pd(i));
+	__m128i offset = _mm_slli_epi32(i, 3);
+
+	const double * coeffs = c.table_coeffs;
+	__m256d f = _mm256_i32gather_pd(coeffs + 3, offset, 8);
+	f = _mm256_fmadd_pd(f, t, _mm256_i32gather_pd(coeffs + 2, offset, 8));
+	f = _mm256_fmadd_pd(f, t, _mm256_i32gather_pd(coeffs + 1, offset, 8));
+	f = _mm256_fmadd_pd(f, t, _mm256_i32gather_pd(coeffs, offset, 8));
+	f = _mm256_and_pd(f, mask);
+	*fx = _mm256_mul_pd(f, dx);
+	*fy = _mm256_mul_pd(f, dy);
+
+	if (with_energy) {
+		__m256d u = _mm256_i32gather_pd(coeffs + 7, offset, 8);
+		u = _mm256_fmadd_pd(u, t, _mm256_i32gather_pd(coeffs + 6, offset, 8));
+		u = _mm256_fmadd_pd(u, t, _mm256_i32gather_pd(coeffs + 5, offset, 8));
+		u = _mm256_fmadd_pd(u, t, _mm256_i32gather_pd(coeffs + 4, offset, 8));
+		*energy = _mm256_and_pd(u, mask);
+	}
+}
+
+/**
+ * @brief Sum the elements of a vector
+ *
+ * @param v The vector
+ * @return double The sum
+ */
+__attribute__((target("avx2,fma")))
+static inline double hsum_avx2(__m256d v) {
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, four pairs at a time with AVX2
+ *        (see range_kernel_scalar)
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void range_avx2(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	const __m256d v_px = _mm256_set1_pd(px);
+	const __m256d v_py = _mm256_set1_pd(py);
+	const __m256d v_r_cut_off_2 = _mm256_set1_pd(c.r_cut_off_2);
+	const __m128i v_skip = _mm_set1_epi32(skip);
+
+	__m256d v_ax = _mm256_setzero_pd();
+	__m256d v_ay = _mm256_setzero_pd();
+	__m256d v_energy = _mm256_setzero_pd();
+
+	int k = first;
+	for (; k + 4 <= nh->count; k += 4) {
+		__m256d dx = _mm256_sub_pd(v_px, _mm256_loadu_pd(&(nh->x[k])));
+		__m256d dy = _mm256_sub_pd(v_py, _mm256_loadu_pd(&(nh->y[k])));
+		__m256d r_2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+
+		// only evaluate pairs within the cut off (and never the particle itself)
+		__m128i is_skip = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &(nh->index[k])), v_skip);
+		__m256d mask = _mm256_cmp_pd(r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		mask = _mm256_andnot_pd(_mm256_castsi256_pd(_mm256_cvtepi32_epi64(is_skip)), mask);
+		if (_mm256_movemask_pd(mask) == 0) {
+			continue;
+		}
+
+		__m256d fx, fy, u;
+		if (form == PAIR_TABLE) {
+			table_avx2(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		} else {
+			lj_avx2(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		}
+		v_ax = _mm256_add_pd(v_ax, fx);
+		v_ay = _mm256_add_pd(v_ay, fy);
+		if (with_energy) {
+			v_energy = _mm256_add_pd(v_energy, u);
+		}
+
+		if (newton) {
+			_mm256_storeu_pd(&(nh->ax[k]), _mm256_sub_pd(_mm256_loadu_pd(&(nh->ax[k])), fx));
+			_mm256_storeu_pd(&(nh->ay[k]), _mm256_sub_pd(_mm256_loadu_pd(&(nh->ay[k])), fy));
+		}
+	}
+
+	*ax += hsum_avx2(v_ax);
+	*ay += hsum_avx2(v_ay);
+	if (with_energy) {
+		*energy += hsum_avx2(v_energy);
+	}
+
+	// finish off any remaining pairs one at a time
+	range_scalar(px, py, nh, k, skip, newton, ax, ay, energy, form, with_energy);
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, four pairs at a time with AVX2
+ *        (see list_kernel_scalar)
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void list_avx2(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	const __m256d v_px = _mm256_set1_pd(px);
+	const __m256d v_py = _mm256_set1_pd(py);
+	const __m256d v_r_cut_off_2 = _mm256_set1_pd(c.r_cut_off_2);
+
+	__m256d v_ax = _mm256_setzero_pd();
+	__m256d v_ay = _mm256_setzero_pd();
+	__m256d v_energy = _mm256_setzero_pd();
+
+	int k = 0;
+	for (; k + 4 <= num; k += 4) {
+		// gather the neighbours' positions and their cell shifts
+		__m128i v_q = _mm_loadu_si128((const __m128i *) &(index[k]));
+		int codes;
+		memcpy(&codes, &(shift[k]), sizeof(int));
+		__m128i v_s = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(codes));
+
+		__m256d dx = _mm256_add_pd(_mm256_sub_pd(v_px, _mm256_i32gather_pd(parts.x, v_q, 8)), _mm256_i32gather_pd(nbrs.shift_x, v_s, 8));
+		__m256d dy = _mm256_add_pd(_mm256_sub_pd(v_py, _mm256_i32gather_pd(parts.y, v_q, 8)), _mm256_i32gather_pd(nbrs.shift_y, v_s, 8));
+		__m256d r_2 = _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy));
+
+		__m256d mask = _mm256_cmp_pd(r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		int live = _mm256_movemask_pd(mask);
+		if (live == 0) {
+			continue;
+		}
+
+		__m256d fx, fy, u;
+		if (form == PAIR_TABLE) {
+			table_avx2(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		} else {
+			lj_avx2(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		}
+		v_ax = _mm256_add_pd(v_ax, fx);
+		v_ay = _mm256_add_pd(v_ay, fy);
+		if (with_energy) {
+			v_energy = _mm256_add_pd(v_energy, u);
+		}
+
+		// AVX2 has no scatter, so apply the opposite accelerations one at a time
+		if (newton) {
+			double q_fx[4], q_fy[4];
+			_mm256_storeu_pd(q_fx, fx);
+			_mm256_storeu_pd(q_fy, fy);
+			for (int l = 0; l < 4; l++) {
+				if (live & (1 << l)) {
+					parts.ax[index[k+l]] -= q_fx[l];
+					parts.ay[index[k+l]] -= q_fy[l];
+				}
+			}
+		}
+	}
+
+	*ax += hsum_avx2(v_ax);
+	*ay += hsum_avx2(v_ay);
+	if (with_energy) {
+		*energy += hsum_avx2(v_energy);
+	}
+
+	list_scalar(px, py, &(index[k]), &(shift[k]), num - k, newton, ax, ay, energy, form, with_energy);
+}
+
+DEFINE_KERNELS_SIMD(avx2, "avx2,fma", , PAIR_LJ)
+DEFINE_KERNELS_SIMD(avx2, "avx2,fma", _default, PAIR_LJ_DEFAULT)
+DEFINE_KERNELS_SIMD(avx2, "avx2,fma", _wca, PAIR_WCA)
+DEFINE_KERNELS_SIMD(avx2, "avx2,fma", _table, PAIR_TABLE)
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for eight pairs at once in single precision (see lj_avx2)
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void lj_avx2_f(const struct pair_constants_f c, __m256 dx, __m256 dy, __m256 r_2, __m256 mask, __m256 * fx, __m256 * fy, __m256 * energy, const int with_energy) {
+	__m256 r_2_inv = _mm256_div_ps(_mm256_set1_ps(1.0f), r_2);
+	__m256 r_6_inv = _mm256_mul_ps(_mm256_mul_ps(r_2_inv, r_2_inv), r_2_inv);
+
+	__m256 f = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(48.0f), _mm256_mul_ps(r_2_inv, r_6_inv)), _mm256_sub_ps(r_6_inv, _mm256_set1_ps(0.5f)));
+	f = _mm256_and_ps(f, mask);
+	*fx = _mm256_mul_ps(f, dx);
+	*fy = _mm256_mul_ps(f, dy);
+
+	if (with_energy) {
+		__m256 u = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), r_6_inv), _mm256_sub_ps(r_6_inv, _mm256_set1_ps(1.0f)));
+		u = _mm256_sub_ps(u, _mm256_set1_ps(c.Uc));
+		u = _mm256_fnmadd_ps(_mm256_set1_ps(c.Duc), _mm256_sub_ps(_mm256_sqrt_ps(r_2), _mm256_set1_ps(c.r_cut_off)), u);
+		*energy = _mm256_and_ps(u, mask);
+	}
+}
+
+/**
+ * @brief Sum the elements of a single precision vector
+ *
+ * @param v The vector
+ * @return float The sum
+ */
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2_f(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	return _mm_cvtss_f32(_mm_add_ss(sum, _mm_movehdup_ps(sum)));
+}
+
+/**
+ * @brief Add a vector of single precision energies to a double precision total
+ *
+ * @param total The total
+ * @param u The energies
+ * @return __m256d The new total
+ */
+__attribute__((target("avx2,fma")))
+static inline __m256d add_energy_avx2_f(__m256d total, __m256 u) {
+	total = _mm256_add_pd(total, _mm256_cvtps_pd(_mm256_castps256_ps128(u)));
+	return _mm256_add_pd(total, _mm256_cvtps_pd(_mm256_extractf128_ps(u, 1)));
+}
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, eight pairs at a time with AVX2 in
+ *        single precision (see range_kernel_scalar)
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void range_avx2_f(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	const __m256 v_px = _mm256_set1_ps((float) px);
+	const __m256 v_py = _mm256_set1_ps((float) py);
+	const __m256 v_r_cut_off_2 = _mm256_set1_ps(c.r_cut_off_2);
+	const __m256i v_skip = _mm256_set1_epi32(skip);
+
+	__m256 v_ax = _mm256_setzero_ps();
+	__m256 v_ay = _mm256_setzero_ps();
+	__m256d v_energy = _mm256_setzero_pd();
+
+	int k = first;
+	for (; k + 8 <= nh->count; k += 8) {
+		__m256 dx = _mm256_sub_ps(v_px, _mm256_loadu_ps(&(nh->xf[k])));
+		__m256 dy = _mm256_sub_ps(v_py, _mm256_loadu_ps(&(nh->yf[k])));
+		__m256 r_2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+
+		// only evaluate pairs within the cut off (and never the particle itself)
+		__m256i is_skip = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) &(nh->index[k])), v_skip);
+		__m256 mask = _mm256_cmp_ps(r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		mask = _mm256_andnot_ps(_mm256_castsi256_ps(is_skip), mask);
+		if (_mm256_movemask_ps(mask) == 0) {
+			continue;
+		}
+
+		__m256 fx, fy, u;
+		lj_avx2_f(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		v_ax = _mm256_add_ps(v_ax, fx);
+		v_ay = _mm256_add_ps(v_ay, fy);
+		if (with_energy) {
+			v_energy = add_energy_avx2_f(v_energy, u);
+		}
+
+		if (newton) {
+			_mm256_storeu_ps(&(nh->axf[k]), _mm256_sub_ps(_mm256_loadu_ps(&(nh->axf[k])), fx));
+			_mm256_storeu_ps(&(nh->ayf[k]), _mm256_sub_ps(_mm256_loadu_ps(&(nh->ayf[k])), fy));
+		}
+	}
+
+	*ax += hsum_avx2_f(v_ax);
+	*ay += hsum_avx2_f(v_ay);
+	if (with_energy) {
+		*energy += hsum_avx2(v_energy);
+	}
+
+	// finish off any remaining pairs one at a time
+	range_scalar_f(px, py, nh, k, skip, newton, ax, ay, energy, with_energy);
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, eight pairs at a time with AVX2
+ *        in single precision (see list_kernel_scalar)
+ */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void list_avx2_f(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	const __m256 v_px = _mm256_set1_ps((float) px);
+	const __m256 v_py = _mm256_set1_ps((float) py);
+	const __m256 v_r_cut_off_2 = _mm256_set1_ps(c.r_cut_off_2);
+
+	__m256 v_ax = _mm256_setzero_ps();
+	__m256 v_ay = _mm256_setzero_ps();
+	__m256d v_energy = _mm256_setzero_pd();
+
+	int k = 0;
+	for (; k + 8 <= num; k += 8) {
+		// gather the neighbours' positions and their cell shifts
+		__m256i v_q = _mm256_loadu_si256((const __m256i *) &(index[k]));
+		__m256i v_s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &(shift[k])));
+
+		__m256 dx = _mm256_add_ps(_mm256_sub_ps(v_px, _mm256_i32gather_ps(nbrs.xf, v_q, 4)), _mm256_i32gather_ps(nbrs.shift_xf, v_s, 4));
+		__m256 dy = _mm256_add_ps(_mm256_sub_ps(v_py, _mm256_i32gather_ps(nbrs.yf, v_q, 4)), _mm256_i32gather_ps(nbrs.shift_yf, v_s, 4));
+		__m256 r_2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+
+		__m256 mask = _mm256_cmp_ps(r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		int live = _mm256_movemask_ps(mask);
+		if (live == 0) {
+			continue;
+		}
+
+		__m256 fx, fy, u;
+		lj_avx2_f(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		v_ax = _mm256_add_ps(v_ax, fx);
+		v_ay = _mm256_add_ps(v_ay, fy);
+		if (with_energy) {
+			v_energy = add_energy_avx2_f(v_energy, u);
+		}
+
+		// AVX2 has no scatter, so apply the opposite accelerations one at a time
+		if (newton) {
+			float q_fx[8], q_fy[8];
+			_mm256_storeu_ps(q_fx, fx);
+			_mm256_storeu_ps(q_fy, fy);
+			for (int l = 0; l < 8; l++) {
+				if (live & (1 << l)) {
+					parts.ax[index[k+l]] -= q_fx[l];
+					parts.ay[index[k+l]] -= q_fy[l];
+				}
+			}
+		}
+	}
+
+	*ax += hsum_avx2_f(v_ax);
+	*ay += hsum_avx2_f(v_ay);
+	if (with_energy) {
+		*energy += hsum_avx2(v_energy);
+	}
+
+	list_scalar_f(px, py, &(index[k]), &(shift[k]), num - k, newton, ax, ay, energy, with_energy);
+}
+
+DEFINE_KERNELS_F(avx2, __attribute__((target("avx2,fma"))))
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for eight pairs at once (see lj_avx2). Lanes outside of the
+ *        mask are left as zero.
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void lj_avx512(const struct pair_constants c, __m512d dx, __m512d dy, __m512d r_2, __mmask8 mask, __m512d * fx, __m512d * fy, __m512d * energy, const int with_energy) {
+	__m512d r_2_inv = _mm512_maskz_div_pd(mask, _mm512_set1_pd(1.0), r_2);
+	__m512d r_6_inv = _mm512_mul_pd(_mm512_mul_pd(r_2_inv, r_2_inv), r_2_inv);
+
+	__m512d f = _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(48.0), _mm512_mul_pd(r_2_inv, r_6_inv)), _mm512_sub_pd(r_6_inv, _mm512_set1_pd(0.5)));
+	*fx = _mm512_mul_pd(f, dx);
+	*fy = _mm512_mul_pd(f, dy);
+
+	if (with_energy) {
+		__m512d u = _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(4.0), r_6_inv), _mm512_sub_pd(r_6_inv, _mm512_set1_pd(1.0)));
+		u = _mm512_sub_pd(u, _mm512_set1_pd(c.Uc));
+		u = _mm512_fnmadd_pd(_mm512_set1_pd(c.Duc), _mm512_sub_pd(_mm512_sqrt_pd(r_2), _mm512_set1_pd(c.r_cut_off)), u);
+		*energy = _mm512_maskz_mov_pd(mask, u);
+	}
+}
+
+/**
+ * @brief Evaluate the tabulated potential for eight pairs at once (see table_avx2). Lanes outside of the
+ *        mask are left as zero.
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void table_avx512(const struct pair_constants c, __m512d dx, __m512d dy, __m512d r_2, __mmask8 mask, __m512d * fx, __m512d * fy, __m512d * energy, const int with_energy) {
+	__m512d s = _mm512_mul_pd(_mm512_sub_pd(r_2, _mm512_set1_pd(c.table_r_2_min)), _mm512_set1_pd(c.table_inv_dr_2));
+	__m256i i = _mm512_cvttpd_epi32(s);
+	i = _mm256_min_epi32(_mm256_max_epi32(i, _mm256_setzero_si256()), _mm256_set1_epi32(TABLE_SIZE - 1));
+	__m512d t = _mm512_sub_pd(s, _mm512_cvtepi32_pd(i));
+	__m256i offset = _mm256_slli_epi32(i, 3);
+
+	const double * coeffs = c.table_coeffs;
+	__m512d f = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 3, 8);
+	f = _mm512_fmadd_pd(f, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 2, 8));
+	f = _mm512_fmadd_pd(f, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 1, 8));
+	f = _mm512_fmadd_pd(f, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs, 8));
+	*fx = _mm512_mul_pd(f, dx);
+	*fy = _mm512_mul_pd(f, dy);
+
+	if (with_energy) {
+		__m512d u = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 7, 8);
+		u = _mm512_fmadd_pd(u, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 6, 8));
+		u = _mm512_fmadd_pd(u, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 5, 8));
+		u = _mm512_fmadd_pd(u, t, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, offset, coeffs + 4, 8));
+		*energy = u;
+	}
+}
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, eight pairs at a time with AVX-512
+ *        (see range_kernel_scalar). The last few entries are handled with masked loads.
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void range_avx512(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	const __m512d v_px = _mm512_set1_pd(px);
+	const __m512d v_py = _mm512_set1_pd(py);
+	const __m512d v_r_cut_off_2 = _mm512_set1_pd(c.r_cut_off_2);
+	const __m256i v_skip = _mm256_set1_epi32(skip);
+
+	__m512d v_ax = _mm512_setzero_pd();
+	__m512d v_ay = _mm512_setzero_pd();
+	__m512d v_energy = _mm512_setzero_pd();
+
+	for (int k = first; k < nh->count; k += 8) {
+		__mmask8 live = (nh->count - k >= 8) ? 0xFF : (__mmask8) ((1 << (nh->count - k)) - 1);
+		live &= ~_mm256_mask_cmpeq_epi32_mask(live, _mm256_maskz_loadu_epi32(live, &(nh->index[k])), v_skip);
+
+		__m512d dx = _mm512_sub_pd(v_px, _mm512_maskz_loadu_pd(live, &(nh->x[k])));
+		__m512d dy = _mm512_sub_pd(v_py, _mm512_maskz_loadu_pd(live, &(nh->y[k])));
+		__m512d r_2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+
+		__mmask8 mask = _mm512_mask_cmp_pd_mask(live, r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		if (mask == 0) {
+			continue;
+		}
+
+		__m512d fx, fy, u;
+		if (form == PAIR_TABLE) {
+			table_avx512(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		} else {
+			lj_avx512(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		}
+		v_ax = _mm512_add_pd(v_ax, fx);
+		v_ay = _mm512_add_pd(v_ay, fy);
+		if (with_energy) {
+			v_energy = _mm512_add_pd(v_energy, u);
+		}
+
+		if (newton) {
+			_mm512_mask_storeu_pd(&(nh->ax[k]), mask, _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, &(nh->ax[k])), fx));
+			_mm512_mask_storeu_pd(&(nh->ay[k]), mask, _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, &(nh->ay[k])), fy));
+		}
+	}
+
+	*ax += _mm512_reduce_add_pd(v_ax);
+	*ay += _mm512_reduce_add_pd(v_ay);
+	if (with_energy) {
+		*energy += _mm512_reduce_add_pd(v_energy);
+	}
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, eight pairs at a time with
+ *        AVX-512 (see list_kernel_scalar). Each particle only appears once in a list, so the opposite
+ *        accelerations can be applied with a scatter.
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void list_avx512(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int form, const int with_energy) {
+	const struct pair_constants c = pair_constants(form);
+	const __m512d v_px = _mm512_set1_pd(px);
+	const __m512d v_py = _mm512_set1_pd(py);
+	const __m512d v_r_cut_off_2 = _mm512_set1_pd(c.r_cut_off_2);
+
+	__m512d v_ax = _mm512_setzero_pd();
+	__m512d v_ay = _mm512_setzero_pd();
+	__m512d v_energy = _mm512_setzero_pd();
+
+	for (int k = 0; k < num; k += 8) {
+		int remaining = (num - k >= 8) ? 8 : num - k;
+		__mmask8 live = (__mmask8) ((1 << remaining) - 1);
+
+		// gather the neighbours' positions and their cell shifts
+		__m256i v_q = _mm256_maskz_loadu_epi32(live, &(index[k]));
+		long long codes = 0;
+		memcpy(&codes, &(shift[k]), remaining);
+		__m256i v_s = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(codes));
+
+		__m512d dx = _mm512_add_pd(_mm512_sub_pd(v_px, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), live, v_q, parts.x, 8)), _mm512_i32gather_pd(v_s, nbrs.shift_x, 8));
+		__m512d dy = _mm512_add_pd(_mm512_sub_pd(v_py, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), live, v_q, parts.y, 8)), _mm512_i32gather_pd(v_s, nbrs.shift_y, 8));
+		__m512d r_2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+
+		__mmask8 mask = _mm512_mask_cmp_pd_mask(live, r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		if (mask == 0) {
+			continue;
+		}
+
+		__m512d fx, fy, u;
+		if (form == PAIR_TABLE) {
+			table_avx512(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		} else {
+			lj_avx512(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		}
+		v_ax = _mm512_add_pd(v_ax, fx);
+		v_ay = _mm512_add_pd(v_ay, fy);
+		if (with_energy) {
+			v_energy = _mm512_add_pd(v_energy, u);
+		}
+
+		if (newton) {
+			__m512d q_ax = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, v_q, parts.ax, 8);
+			__m512d q_ay = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, v_q, parts.ay, 8);
+			_mm512_mask_i32scatter_pd(parts.ax, mask, v_q, _mm512_sub_pd(q_ax, fx), 8);
+			_mm512_mask_i32scatter_pd(parts.ay, mask, v_q, _mm512_sub_pd(q_ay, fy), 8);
+		}
+	}
+
+	*ax += _mm512_reduce_add_pd(v_ax);
+	*ay += _mm512_reduce_add_pd(v_ay);
+	if (with_energy) {
+		*energy += _mm512_reduce_add_pd(v_energy);
+	}
+}
+
+DEFINE_KERNELS_SIMD(avx512, "avx512f,avx512vl", , PAIR_LJ)
+DEFINE_KERNELS_SIMD(avx512, "avx512f,avx512vl", _default, PAIR_LJ_DEFAULT)
+DEFINE_KERNELS_SIMD(avx512, "avx512f,avx512vl", _wca, PAIR_WCA)
+DEFINE_KERNELS_SIMD(avx512, "avx512f,avx512vl", _table, PAIR_TABLE)
+
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for sixteen pairs at once in single precision (see lj_avx512)
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void lj_avx512_f(const struct pair_constants_f c, __m512 dx, __m512 dy, __m512 r_2, __mmask16 mask, __m512 * fx, __m512 * fy, __m512 * energy, const int with_energy) {
+	__m512 r_2_inv = _mm512_maskz_div_ps(mask, _mm512_set1_ps(1.0f), r_2);
+	__m512 r_6_inv = _mm512_mul_ps(_mm512_mul_ps(r_2_inv, r_2_inv), r_2_inv);
+
+	__m512 f = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(48.0f), _mm512_mul_ps(r_2_inv, r_6_inv)), _mm512_sub_ps(r_6_inv, _mm512_set1_ps(0.5f)));
+	*fx = _mm512_mul_ps(f, dx);
+	*fy = _mm512_mul_ps(f, dy);
+
+	if (with_energy) {
+		__m512 u = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(4.0f), r_6_inv), _mm512_sub_ps(r_6_inv, _mm512_set1_ps(1.0f)));
+		u = _mm512_sub_ps(u, _mm512_set1_ps(c.Uc));
+		u = _mm512_fnmadd_ps(_mm512_set1_ps(c.Duc), _mm512_sub_ps(_mm512_sqrt_ps(r_2), _mm512_set1_ps(c.r_cut_off)), u);
+		*energy = _mm512_maskz_mov_ps(mask, u);
+	}
+}
+
+/**
+ * @brief Add a vector of single precision energies to a double precision total
+ *
+ * @param total The total
+ * @param u The energies
+ * @return __m512d The new total
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512d add_energy_avx512_f(__m512d total, __m512 u) {
+	total = _mm512_add_pd(total, _mm512_cvtps_pd(_mm512_castps512_ps256(u)));
+	return _mm512_add_pd(total, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(u), 1))));
+}
+
+/**
+ * @brief Evaluate a particle against the entries of a neighbourhood, sixteen pairs at a time with AVX-512
+ *        in single precision (see range_kernel_scalar)
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void range_avx512_f(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	const __m512 v_px = _mm512_set1_ps((float) px);
+	const __m512 v_py = _mm512_set1_ps((float) py);
+	const __m512 v_r_cut_off_2 = _mm512_set1_ps(c.r_cut_off_2);
+	const __m512i v_skip = _mm512_set1_epi32(skip);
+
+	__m512 v_ax = _mm512_setzero_ps();
+	__m512 v_ay = _mm512_setzero_ps();
+	__m512d v_energy = _mm512_setzero_pd();
+
+	for (int k = first; k < nh->count; k += 16) {
+		__mmask16 live = (nh->count - k >= 16) ? 0xFFFF : (__mmask16) ((1 << (nh->count - k)) - 1);
+		live &= ~_mm512_mask_cmpeq_epi32_mask(live, _mm512_maskz_loadu_epi32(live, &(nh->index[k])), v_skip);
+
+		__m512 dx = _mm512_sub_ps(v_px, _mm512_maskz_loadu_ps(live, &(nh->xf[k])));
+		__m512 dy = _mm512_sub_ps(v_py, _mm512_maskz_loadu_ps(live, &(nh->yf[k])));
+		__m512 r_2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+		__mmask16 mask = _mm512_mask_cmp_ps_mask(live, r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		if (mask == 0) {
+			continue;
+		}
+
+		__m512 fx, fy, u;
+		lj_avx512_f(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		v_ax = _mm512_add_ps(v_ax, fx);
+		v_ay = _mm512_add_ps(v_ay, fy);
+		if (with_energy) {
+			v_energy = add_energy_avx512_f(v_energy, u);
+		}
+
+		if (newton) {
+			_mm512_mask_storeu_ps(&(nh->axf[k]), mask, _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, &(nh->axf[k])), fx));
+			_mm512_mask_storeu_ps(&(nh->ayf[k]), mask, _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, &(nh->ayf[k])), fy));
+		}
+	}
+
+	*ax += _mm512_reduce_add_ps(v_ax);
+	*ay += _mm512_reduce_add_ps(v_ay);
+	if (with_energy) {
+		*energy += _mm512_reduce_add_pd(v_energy);
+	}
+}
+
+/**
+ * @brief Apply the opposite of a vector of single precision accelerations to (double precision) particles,
+ *        using a scatter for each half of the vector
+ *
+ * @param a The particle accelerations
+ * @param mask The particles to update
+ * @param v_q The particles
+ * @param f The accelerations
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline void scatter_sub_avx512_f(double * a, __mmask16 mask, __m512i v_q, __m512 f) {
+	__m256i q_lo = _mm512_castsi512_si256(v_q);
+	__m256i q_hi = _mm512_extracti64x4_epi64(v_q, 1);
+	__m512d f_lo = _mm512_cvtps_pd(_mm512_castps512_ps256(f));
+	__m512d f_hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(f), 1)));
+	__mmask8 mask_lo = (__mmask8) (mask & 0xFF);
+	__mmask8 mask_hi = (__mmask8) (mask >> 8);
+
+	__m512d a_lo = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask_lo, q_lo, a, 8);
+	_mm512_mask_i32scatter_pd(a, mask_lo, q_lo, _mm512_sub_pd(a_lo, f_lo), 8);
+	__m512d a_hi = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask_hi, q_hi, a, 8);
+	_mm512_mask_i32scatter_pd(a, mask_hi, q_hi, _mm512_sub_pd(a_hi, f_hi), 8);
+}
+
+/**
+ * @brief Evaluate a particle against the particles in its neighbour list, sixteen pairs at a time with
+ *        AVX-512 in single precision (see list_kernel_avx512)
+ */
+__attribute__((target("avx512f,avx512vl")))
+static inline __attribute__((always_inline)) void list_avx512_f(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy, const int with_energy) {
+	const struct pair_constants_f c = constants_f;
+	const __m512 v_px = _mm512_set1_ps((float) px);
+	const __m512 v_py = _mm512_set1_ps((float) py);
+	const __m512 v_r_cut_off_2 = _mm512_set1_ps(c.r_cut_off_2);
+
+	__m512 v_ax = _mm512_setzero_ps();
+	__m512 v_ay = _mm512_setzero_ps();
+	__m512d v_energy = _mm512_setzero_pd();
+
+	for (int k = 0; k < num; k += 16) {
+		int remaining = (num - k >= 16) ? 16 : num - k;
+		__mmask16 live = (__mmask16) ((1 << remaining) - 1);
+
+		// gather the neighbours' positions and their cell shifts
+		__m512i v_q = _mm512_maskz_loadu_epi32(live, &(index[k]));
+		unsigned char codes[16] = {0};
+		memcpy(codes, &(shift[k]), remaining);
+		__m512i v_s = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) codes));
+
+		__m512 dx = _mm512_add_ps(_mm512_sub_ps(v_px, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), live, v_q, nbrs.xf, 4)), _mm512_i32gather_ps(v_s, nbrs.shift_xf, 4));
+		__m512 dy = _mm512_add_ps(_mm512_sub_ps(v_py, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), live, v_q, nbrs.yf, 4)), _mm512_i32gather_ps(v_s, nbrs.shift_yf, 4));
+		__m512 r_2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+		__mmask16 mask = _mm512_mask_cmp_ps_mask(live, r_2, v_r_cut_off_2, _CMP_LT_OQ);
+		if (mask == 0) {
+			continue;
+		}
+
+		__m512 fx, fy, u;
+		lj_avx512_f(c, dx, dy, r_2, mask, &fx, &fy, &u, with_energy);
+		v_ax = _mm512_add_ps(v_ax, fx);
+		v_ay = _mm512_add_ps(v_ay, fy);
+		if (with_energy) {
+			v_energy = add_energy_avx512_f(v_energy, u);
+		}
+
+		if (newton) {
+			scatter_sub_avx512_f(parts.ax, mask, v_q, fx);
+			scatter_sub_avx512_f(parts.ay, mask, v_q, fy);
+		}
+	}
+
+	*ax += _mm512_reduce_add_ps(v_ax);
+	*ay += _mm512_reduce_add_ps(v_ay);
+	if (with_energy) {
+		*energy += _mm512_reduce_add_pd(v_energy);
+	}
+}
+
+DEFINE_KERNELS_F(avx512, __attribute__((target("avx512f,avx512vl"))))
+
+#endif
+
+/**
+ * @brief Convert a kernel name (as given on the command line) into a kernel
+ *
+ * @param name The name of the kernel
+ * @return int The kernel, or -1 if the name is not recognised
+ */
+int parse_kernel(char * name) {
+	for (int k = KERNEL_AUTO; k <= KERNEL_AVX512; k++) {
+		if (strcmp(name, kernel_name(k)) == 0) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Get the name of a kernel
+ *
+ * @param k The kernel
+ * @return const char* The name of the kernel
+ */
+const char * kernel_name(int k) {
+	switch (k) {
+		case KERNEL_SCALAR: return "scalar";
+		case KERNEL_AVX2: return "avx2";
+		case KERNEL_AVX512: return "avx512";
+		default: return "auto";
+	}
+}
+
+// the kernels for each instruction set (in the order of their identifiers) and form of pair evaluation
+#ifdef __x86_64__
+#define NUM_ISAS 3
+#else
+#define NUM_ISAS 1
+#endif
+static const range_kernel_t range_kernels[NUM_ISAS][4] = {
+	{range_kernel_scalar, range_kernel_scalar_default, range_kernel_scalar_wca, range_kernel_scalar_table},
+#ifdef __x86_64__
+	{range_kernel_avx2, range_kernel_avx2_default, range_kernel_avx2_wca, range_kernel_avx2_table},
+	{range_kernel_avx512, range_kernel_avx512_default, range_kernel_avx512_wca, range_kernel_avx512_table}
+#endif
+};
+static const list_kernel_t list_kernels[NUM_ISAS][4] = {
+	{list_kernel_scalar, list_kernel_scalar_default, list_kernel_scalar_wca, list_kernel_scalar_table},
+#ifdef __x86_64__
+	{list_kernel_avx2, list_kernel_avx2_default, list_kernel_avx2_wca, list_kernel_avx2_table},
+	{list_kernel_avx512, list_kernel_avx512_default, list_kernel_avx512_wca, list_kernel_avx512_table}
+#endif
+};
+
+// the forces-only kernels, in the same order
+static const range_kernel_t range_force_kernels[NUM_ISAS][4] = {
+	{range_forces_scalar, range_forces_scalar_default, range_forces_scalar_wca, range_forces_scalar_table},
+#ifdef __x86_64__
+	{range_forces_avx2, range_forces_avx2_default, range_forces_avx2_wca, range_forces_avx2_table},
+	{range_forces_avx512, range_forces_avx512_default, range_forces_avx512_wca, range_forces_avx512_table}
+#endif
+};
+static const list_kernel_t list_force_kernels[NUM_ISAS][4] = {
+	{list_forces_scalar, list_forces_scalar_default, list_forces_scalar_wca, list_forces_scalar_table},
+#ifdef __x86_64__
+	{list_forces_avx2, list_forces_avx2_default, list_forces_avx2_wca, list_forces_avx2_table},
+	{list_forces_avx512, list_forces_avx512_default, list_forces_avx512_wca, list_forces_avx512_table}
+#endif
+};
+
+// the single precision kernels for each instruction set
+static const range_kernel_t range_kernels_f[NUM_ISAS] = {
+	range_kernel_scalar_f,
+#ifdef __x86_64__
+	range_kernel_avx2_f,
+	range_kernel_avx512_f
+#endif
+};
+static const list_kernel_t list_kernels_f[NUM_ISAS] = {
+	list_kernel_scalar_f,
+#ifdef __x86_64__
+	list_kernel_avx2_f,
+	list_kernel_avx512_f
+#endif
+};
+static const range_kernel_t range_force_kernels_f[NUM_ISAS] = {
+	range_forces_scalar_f,
+#ifdef __x86_64__
+	range_forces_avx2_f,
+	range_forces_avx512_f
+#endif
+};
+static const list_kernel_t list_force_kernels_f[NUM_ISAS] = {
+	list_forces_scalar_f,
+#ifdef __x86_64__
+	list_forces_avx2_f,
+	list_forces_avx512_f
+#endif
+};
+
+/**
+ * @brief Choose the force kernels once per run, based on the requested kernel and what the CPU supports.
+ *        If no kernel was requested, the widest supported kernel is used. With mixed precision, the
+ *        single precision version of each kernel is used. Otherwise the kernel is specialised for the
+ *        potential: the table, or Lennard-Jones with its cut off compiled in where it is fixed (WCA, or
+ *        the default cut off). Each kernel also has a forces-only version. This also sets up a neighbourhood
+ *        for each thread.
+ *
+ */
+void select_kernel() {
+	int has_avx2 = 0;
+	int has_avx512 = 0;
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	has_avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+#endif
+
+	if (kernel == KERNEL_AUTO) {
+		kernel = has_avx512 ? KERNEL_AVX512 : (has_avx2 ? KERNEL_AVX2 : KERNEL_SCALAR);
+	}
+
+	if (((kernel == KERNEL_AVX2) && !has_avx2) || ((kernel == KERNEL_AVX512) && !has_avx512)) {
+		fprintf(stderr, "Error: The %s kernel is not supported on this CPU.\n", kernel_name(kernel));
+		exit(1);
+	}
+
+	thread_neighbourhoods = (struct neighbourhood *) calloc(omp_get_max_threads(), sizeof(struct neighbourhood));
+
+	constants_f.r_cut_off = (float) r_cut_off;
+	constants_f.r_cut_off_2 = (float) r_cut_off_2;
+	constants_f.Uc = (float) Uc;
+	constants_f.Duc = (float) Duc;
+
+	int form = PAIR_LJ;
+	if (table_type != TABLE_NONE) {
+		form = PAIR_TABLE;
+	} else if (potential == POTENTIAL_WCA) {
+		form = PAIR_WCA;
+	} else if (r_cut_off == LJ_DEFAULT_CUT_OFF) {
+		form = PAIR_LJ_DEFAULT;
+	}
+
+	int isa = kernel - KERNEL_SCALAR;
+	range_kernel = mixed_precision ? range_kernels_f[isa] : range_kernels[isa][form];
+	list_kernel = mixed_precision ? list_kernels_f[isa] : list_kernels[isa][form];
+	range_force_kernel = mixed_precision ? range_force_kernels_f[isa] : range_force_kernels[isa][form];
+	list_force_kernel = mixed_precision ? list_force_kernels_f[isa] : list_force_kernels[isa][form];
+}
+
+/**
+ * @brief Get the neighbourhood for the current thread
+ *
+ * @return struct neighbourhood* The neighbourhood
+ */
+struct neighbourhood * get_neighbourhood() {
+	return &(thread_neighbourhoods[omp_get_thread_num()]);
+}
+
+/**
+ * @brief Make sure a neighbourhood has room for a number of entries
+ *
+ * @param nh The neighbourhood
+ * @param n The number of entries
+ */
+void reserve_neighbourhood(struct neighbourhood * nh, int n) {
+	if (n <= nh->capacity) {
+		return;
+	}
+
+	nh->capacity = 2 * n;
+	nh->x = (double *) realloc(nh->x, nh->capacity * sizeof(double));
+	nh->y = (double *) realloc(nh->y, nh->capacity * sizeof(double));
+	nh->ax = (double *) realloc(nh->ax, nh->capacity * sizeof(double));
+	nh->ay = (double *) realloc(nh->ay, nh->capacity * sizeof(double));
+	nh->xf = (float *) realloc(nh->xf, nh->capacity * sizeof(float));
+	nh->yf = (float *) realloc(nh->yf, nh->capacity * sizeof(float));
+	nh->axf = (float *) realloc(nh->axf, nh->capacity * sizeof(float));
+	nh->ayf = (float *) realloc(nh->ayf, nh->capacity * sizeof(float));
+	nh->index = (int *) realloc(nh->index, nh->capacity * sizeof(int));
+}
+
+/**
+ * @brief Free the neighbourhood of every thread
+ * 
+ */
+void free_neighbourhoods() {
+	for (int t = 0; t < omp_get_max_threads(); t++) {
+		struct neighbourhood * nh = &(thread_neighbourhoods[t]);
+		free(nh->x);
+		free(nh->y);
+		free(nh->ax);
+		free(nh->ay);
+		free(nh->xf);
+		free(nh->yf);
+		free(nh->axf);
+		free(nh->ayf);
+		free(nh->index);
+	}
+	free(thread_neighbourhoods);
+	thread_neighbourhoods = NULL;
+}
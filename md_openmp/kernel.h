@@ -0,0 +1,41 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+// the available force kernels
+#define KERNEL_AUTO 0
+#define KERNEL_SCALAR 1
+#define KERNEL_AVX2 2
+#define KERNEL_AVX512 3
+
+// a packed copy of the particles in the cells around a cell, with their positions shifted into that cell's frame
+struct neighbourhood {
+	double * x, * y; // position relative to the centre cell
+	double * ax, * ay; // acceleration to be added back to the particles (when using Newton's third law)
+	float * xf, * yf; // single precision position (for mixed precision)
+	float * axf, * ayf; // single precision acceleration (for mixed precision)
+	int * index; // the particle each entry is a copy of
+	int count;
+	int capacity;
+};
+
+// evaluate a particle (at px, py) against the entries of a neighbourhood from first onwards, skipping the particle given by skip
+typedef void (*range_kernel_t)(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy);
+
+// evaluate a particle (at px, py) against the particles in a neighbour list
+typedef void (*list_kernel_t)(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy);
+
+extern int kernel;
+extern range_kernel_t range_kernel;
+extern list_kernel_t list_kernel;
+// the forces-only versions of the kernels (which leave the energy alone)
+extern range_kernel_t range_force_kernel;
+extern list_kernel_t list_force_kernel;
+
+int parse_kernel(char * name);
+const char * kernel_name(int k);
+void select_kernel();
+struct neighbourhood * get_neighbourhood();
+void reserve_neighbourhood(struct neighbourhood * nh, int n);
+void free_neighbourhoods();
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <omp.h>
@@ -7,86 +8,354 @@
 #include "args.h"
 #include "boundary.h"
 #include "data.h"
+#include "kernel.h"
+#include "neighbour.h"
+#include "order.h"
+#include "potential.h"
 #include "setup.h"
+#include "stencil.h"
 #include "vtk.h"
 
 /**
- * @brief This routine calculates the acceleration felt by each particle based on evaluating the Lennard-Jones 
- *        potential with its neighbours. It only evaluates particles within a cut-off radius, and uses cells to 
- *        reduce the search space. It also calculates the potential energy of the system. 
+ * @brief Pack the particles in the cells around a cell into a neighbourhood, shifting their positions into the
+ *        frame of the centre cell (so the force kernels can work through them as one contiguous block).
+ *        The cells are those in the stencil, so the centre cell always comes first, followed by the rest
+ *        of the half-shell stencil. With mixed precision, the positions are stored in single precision.
  * 
- * @return double The potential energy
+ * @param nh The neighbourhood to fill
+ * @param i The x index of the centre cell
+ * @param j The y index of the centre cell
+ * @param half Whether to only include the half-shell stencil (in which case the accelerations are zeroed)
  */
-double comp_accel() {
-	// zero acceleration for every particle
-	#pragma omp parallel for collapse(2)
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				p->ax = 0.0;
-				p->ay = 0.0;
-				p = p->next;
+static void gather_neighbourhood(struct neighbourhood * nh, int i, int j, int half) {
+	int num_cells = half ? num_half_stencil : num_stencil;
+
+	// the cells are stored in one block, so each stencil cell is a fixed distance from the centre cell
+	struct cell_list * centre = &(cells[i][j]);
+	int row = y + 2*halo;
+
+	int count = 0;
+	for (int s = 0; s < num_cells; s++) {
+		count += centre[stencil[s].a * row + stencil[s].b].count;
+	}
+	reserve_neighbourhood(nh, count);
+
+	// (the branches are outside the copy loops, since with small cells there are lots of short copies)
+	nh->count = 0;
+	for (int s = 0; s < num_cells; s++) {
+		struct cell_list * n = &(centre[stencil[s].a * row + stencil[s].b]);
+		double shift_x = stencil[s].a * cell_size;
+		double shift_y = stencil[s].b * cell_size;
+		int k = nh->count;
+		if (mixed_precision) {
+			for (int q = 0; q < n->count; q++) {
+				nh->xf[k+q] = (float) (parts.x[n->start+q] + shift_x);
+				nh->yf[k+q] = (float) (parts.y[n->start+q] + shift_y);
 			}
+		} else {
+			for (int q = 0; q < n->count; q++) {
+				nh->x[k+q] = parts.x[n->start+q] + shift_x;
+				nh->y[k+q] = parts.y[n->start+q] + shift_y;
+			}
+		}
+		for (int q = 0; q < n->count; q++) {
+			nh->index[k+q] = n->start + q;
 		}
+		nh->count += n->count;
 	}
 
-	double pot_energy = 0.0;
-	#pragma omp parallel for collapse(2) reduction(+:pot_energy)
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			double cell_offset_x = (i-1) * cell_size;
-			double cell_offset_y = (j-1) * cell_size;
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				// Compare each particle with all particles in the 9 cells
-				for (int a = -1; a <= 1; a++) {
-					for (int b = -1; b <= 1; b++) {
-						struct particle_t * q = cells[i+a][j+b].head;
-						while (q != NULL) {
-							// if p and q are the same particle, skip
-							if (p == q) {
-								q = q->next;
-								continue;
-							}
-
-							// since particles are stored relative to their cell, calculate the
-							// actual x and y coordinates.
-							double p_real_x = (cell_offset_x) + p->x;
-							double p_real_y = (cell_offset_y) + p->y;
-							double q_real_x = ((i+a-1) * cell_size) + q->x;
-							double q_real_y = ((j+b-1) * cell_size) + q->y;
-							
-							// calculate distance in x and y, then absolute distance
-							double dx = p_real_x - q_real_x;
-							double dy = p_real_y - q_real_y;
-							double r_2 = dx*dx + dy*dy;
-							
-							// if distance less than cut off, calculate force and 
-							// use this to calculate acceleration in each dimension
-							// calculate potential energy of each particle at the same time
-							
-							if (r_2 < r_cut_off_2) {
-								double r_2_inv = 1.0 / r_2;
-								double r_6_inv = r_2_inv * r_2_inv * r_2_inv;
-								
-								double f = (48.0 * r_2_inv * r_6_inv * (r_6_inv - 0.5));
-								
-								p->ax += f*dx;
-								p->ay += f*dy;
-
-								pot_energy += 4.0 * r_6_inv * (r_6_inv - 1.0) - Uc - Duc * (sqrt(r_2) - r_cut_off);
-							}
-							q = q->next;
-						}
-					}
+	if (half) {
+		if (mixed_precision) {
+			memset(nh->axf, 0, nh->count * sizeof(float));
+			memset(nh->ayf, 0, nh->count * sizeof(float));
+		} else {
+			memset(nh->ax, 0, nh->count * sizeof(double));
+			memset(nh->ay, 0, nh->count * sizeof(double));
+		}
+	}
+}
+
+// totals shared between the threads, so they can be reduced from within the parallel region (each is only
+// reset at the next call, by which time every thread has read it)
+static double pot_energy_total;
+static double kinetic_energy_total;
+static int moved_total;
+static double max_disp_2_total;
+
+/**
+ * @brief Calculate the acceleration of each particle by comparing it with every particle in the stencil
+ *        around it (so each pair is evaluated twice, once from each side). Cells are visited in the order
+ *        they are stored in.
+ * 
+ * @param energy Whether to calculate the energies (otherwise the forces-only kernel is used, and 0 is returned)
+ * @param kick Whether to also update the velocity of each particle for the second half of the time step once
+ *             its acceleration is known (for the fused integrator), adding up the kinetic energy in kinetic_energy_total
+ * @return double The potential energy
+ */
+static double comp_accel_full_shell(int energy, int kick) {
+	range_kernel_t kern = energy ? range_kernel : range_force_kernel;
+
+	#pragma omp single
+	{
+		pot_energy_total = 0.0;
+		kinetic_energy_total = 0.0;
+	}
+
+	#pragma omp for schedule(static) reduction(+:pot_energy_total,kinetic_energy_total)
+	for (int n = 0; n < x * y; n++) {
+		int i = cell_order[n] / (y+2*halo);
+		int j = cell_order[n] % (y+2*halo);
+		// (small cells are often empty, so don't gather around them)
+		if (cells[i][j].count == 0) {
+			continue;
+		}
+		struct neighbourhood * nh = get_neighbourhood();
+		gather_neighbourhood(nh, i, j, 0);
+
+		// Compare each particle with all particles in the stencil (the cell's own particles are
+		// at the start of the neighbourhood, in the same order)
+		struct cell_list * c = &(cells[i][j]);
+		for (int p = c->start; p < c->start + c->count; p++) {
+			// accumulate the acceleration locally (so there is no need to zero it first)
+			double p_ax = 0.0;
+			double p_ay = 0.0;
+			kern(parts.x[p], parts.y[p], nh, 0, p, 0, &p_ax, &p_ay, &pot_energy_total);
+			parts.ax[p] = p_ax;
+			parts.ay[p] = p_ay;
+
+			// nothing else adds to this particle, so it can be given its second half-kick straight away
+			if (kick) {
+				parts.vx[p] += dth * p_ax;
+				parts.vy[p] += dth * p_ay;
+				if (energy) {
+					kinetic_energy_total += (parts.vx[p] * parts.vx[p]) + (parts.vy[p] * parts.vy[p]);
 				}
-				p = p->next;
 			}
 		}
 	}
 	// return the average potential energy (i.e. sum / number)
-	return pot_energy / num_particles;
+	return pot_energy_total / num_particles;
+}
+
+/**
+ * @brief Evaluate the pairs for every cell in a column, using a half-shell stencil (the cell itself,
+ *        the cells above it and the cells in the next halo columns), and applying equal and opposite
+ *        accelerations to both particles of each pair (i.e. using Newton's third law). This updates
+ *        the accelerations of particles in this column and the next halo columns, but no others.
+ * 
+ * @param i The column
+ * @param energy Whether to calculate the potential energy
+ * @return double The potential energy of the pairs
+ */
+static double half_shell_column(int i, int energy) {
+	range_kernel_t kern = energy ? range_kernel : range_force_kernel;
+	struct neighbourhood * nh = get_neighbourhood();
+	double pot_energy = 0.0;
+	for (int j = 1; j < y+1; j++) {
+		if (cells[i][j].count == 0) {
+			continue;
+		}
+		gather_neighbourhood(nh, i, j, 1);
+
+		// the cell's own particles are at the start of the neighbourhood, so only compare
+		// each particle with those after it
+		struct cell_list * c = &(cells[i][j]);
+		for (int t = 0; t < c->count; t++) {
+			int p = c->start + t;
+			double p_ax = 0.0;
+			double p_ay = 0.0;
+			kern(parts.x[p], parts.y[p], nh, t+1, -1, 1, &p_ax, &p_ay, &pot_energy);
+			parts.ax[p] += p_ax;
+			parts.ay[p] += p_ay;
+		}
+
+		// add the opposite accelerations back on to the particles
+		if (mixed_precision) {
+			for (int k = 0; k < nh->count; k++) {
+				parts.ax[nh->index[k]] += nh->axf[k];
+				parts.ay[nh->index[k]] += nh->ayf[k];
+			}
+		} else {
+			for (int k = 0; k < nh->count; k++) {
+				parts.ax[nh->index[k]] += nh->ax[k];
+				parts.ay[nh->index[k]] += nh->ay[k];
+			}
+		}
+	}
+	return pot_energy;
+}
+
+/**
+ * @brief Run a half-shell column routine over every column. Since a column only updates itself and the next halo
+ *        columns, the columns are given halo+1 colours (in turn), so that columns of the same colour can be run in
+ *        parallel. The last columns update the ghost columns (rather than the first columns, which they are copies
+ *        of), so they don't clash with the first, and the ghost accelerations are added back afterwards (by
+ *        fold_halo). The potential energy is added to pot_energy_total.
+ * 
+ * @param column The column routine
+ * @param energy Whether to calculate the potential energy
+ */
+static void colour_columns(double (*column)(int, int), int energy) {
+	int num_colours = halo + 1;
+	for (int colour = 1; colour <= num_colours; colour++) {
+		#pragma omp for schedule(static) reduction(+:pot_energy_total)
+		for (int i = colour; i <= x; i += num_colours) {
+			pot_energy_total += column(i, energy);
+		}
+	}
+
+	fold_halo();
+}
+
+/**
+ * @brief Calculate the acceleration of each particle using a half-shell stencil, so each pair is only evaluated
+ *        once (with the columns run in parallel by colour_columns).
+ * 
+ * @param energy Whether to calculate the potential energy
+ * @return double The potential energy
+ */
+static double comp_accel_half_shell(int energy) {
+	#pragma omp single nowait
+	pot_energy_total = 0.0;
+
+	// zero acceleration for every particle (and ghost copy), since pairs add to both particles
+	#pragma omp for schedule(static)
+	for (int p = 0; p < num_particles + num_ghosts; p++) {
+		parts.ax[p] = 0.0;
+		parts.ay[p] = 0.0;
+	}
+
+	colour_columns(half_shell_column, energy);
+
+	// each pair has only been counted once, so count it for both particles (to match the full shell)
+	return 2.0 * pot_energy_total / num_particles;
+}
+
+/**
+ * @brief Evaluate the pairs in the neighbour lists of every particle in a cell. With the half-shell
+ *        stencil, equal and opposite accelerations are applied to both particles of each pair.
+ * 
+ * @param c The cell
+ * @param energy Whether to calculate the energies
+ * @param kick Whether to also update the velocity of each particle for the second half of the time step (only
+ *             possible without the half-shell stencil, since otherwise other cells add to the accelerations)
+ * @param kinetic_energy Where to add up the kinetic energy of the particles (when kicking them)
+ * @return double The potential energy of the pairs
+ */
+static double neighbour_list_cell(struct cell_list * c, int energy, int kick, double * kinetic_energy) {
+	list_kernel_t kern = energy ? list_kernel : list_force_kernel;
+	double pot_energy = 0.0;
+	for (int p = c->start; p < c->start + c->count; p++) {
+		double p_ax = 0.0;
+		double p_ay = 0.0;
+		int num = nbrs.start[p+1] - nbrs.start[p];
+		kern(parts.x[p], parts.y[p], &(nbrs.index[nbrs.start[p]]), &(nbrs.shift[nbrs.start[p]]), num, half_shell, &p_ax, &p_ay, &pot_energy);
+		parts.ax[p] += p_ax;
+		parts.ay[p] += p_ay;
+
+		if (kick) {
+			parts.vx[p] += dth * parts.ax[p];
+			parts.vy[p] += dth * parts.ay[p];
+			if (energy) {
+				*kinetic_energy += (parts.vx[p] * parts.vx[p]) + (parts.vy[p] * parts.vy[p]);
+			}
+		}
+	}
+	return pot_energy;
+}
+
+/**
+ * @brief Evaluate the pairs in the neighbour lists of every particle in a column. With the half-shell
+ *        stencil, this only updates particles in this column and the next halo columns (as with half_shell_column).
+ * 
+ * @param i The column
+ * @param energy Whether to calculate the potential energy
+ * @return double The potential energy of the pairs
+ */
+static double neighbour_list_column(int i, int energy) {
+	double pot_energy = 0.0;
+	for (int j = 1; j < y+1; j++) {
+		pot_energy += neighbour_list_cell(&(cells[i][j]), energy, 0, NULL);
+	}
+	return pot_energy;
+}
+
+/**
+ * @brief Calculate the acceleration of each particle from its neighbour list. With half-shell lists, the
+ *        particles are visited by cell column, so that they can use the same colouring as comp_accel_half_shell.
+ *        Otherwise the cells are visited in the order they are stored in.
+ * 
+ * @param energy Whether to calculate the energies
+ * @param kick Whether to also give each particle its second half-kick (as in comp_accel_full_shell), which is
+ *             ignored with half-shell lists
+ * @return double The potential energy
+ */
+static double comp_accel_neighbour_lists(int energy, int kick) {
+	if (mixed_precision) {
+		update_single_positions();
+	}
+
+	#pragma omp single nowait
+	{
+		pot_energy_total = 0.0;
+		kinetic_energy_total = 0.0;
+	}
+
+	// (with half-shell lists, pairs add to the ghost copies too)
+	int num_zero = half_shell ? num_particles + num_ghosts : num_particles;
+	#pragma omp for schedule(static)
+	for (int p = 0; p < num_zero; p++) {
+		parts.ax[p] = 0.0;
+		parts.ay[p] = 0.0;
+	}
+
+	if (half_shell) {
+		colour_columns(neighbour_list_column, energy);
+
+		// each pair has only been counted once, so count it for both particles (to match the full shell)
+		return 2.0 * pot_energy_total / num_particles;
+	}
+
+	#pragma omp for schedule(static) reduction(+:pot_energy_total,kinetic_energy_total)
+	for (int n = 0; n < x * y; n++) {
+		pot_energy_total += neighbour_list_cell(&(cells[0][cell_order[n]]), energy, kick, &kinetic_energy_total);
+	}
+	return pot_energy_total / num_particles;
+}
+
+/**
+ * @brief This routine calculates the acceleration felt by each particle based on evaluating the Lennard-Jones 
+ *        potential with its neighbours. It only evaluates particles within a cut-off radius, and uses cells to 
+ *        reduce the search space. It also calculates the potential energy of the system. This (like the
+ *        other routines in the time loop) is called by every thread from within the parallel region.
+ * 
+ * @param energy Whether to calculate the potential energy. Without it, the forces-only kernels are used
+ *               (which skip the energy, and its square root, for every pair) and 0 is returned.
+ * @return double The potential energy (on every thread)
+ */
+double comp_accel(int energy) {
+	if (skin > 0.0) {
+		return comp_accel_neighbour_lists(energy, 0);
+	}
+	if (half_shell) {
+		return comp_accel_half_shell(energy);
+	}
+	return comp_accel_full_shell(energy, 0);
+}
+
+/**
+ * @brief Update the velocity of a particle for half a time step and then move it for a whole time step
+ * 
+ * @param p The particle
+ */
+static inline void kick_drift(int p) {
+	// update velocity to obtain v(t + Dt/2)
+	parts.vx[p] += dth * parts.ax[p];
+	parts.vy[p] += dth * parts.ay[p];
+
+	// update particle coordinates to p(t + Dt) (scaled to the cell_size)
+	parts.x[p] += (dt * parts.vx[p]);
+	parts.y[p] += (dt * parts.vy[p]);
 }
 
 /**
@@ -95,23 +364,68 @@ double comp_accel() {
  * 
  */
 void move_particles() {
-	// move all particles half a time step
-	#pragma omp parallel for collapse(2) 
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				// update velocity to obtain v(t + Dt/2)
-				p->vx += dth * p->ax;
-				p->vy += dth * p->ay;
-
-				// update particle coordinates to p(t + Dt) (scaled to the cell_size)
-				p->x += (dt * p->vx);
-				p->y += (dt * p->vy);
-
-				p = p->next;
-			}
+	// move all particles half a time step (since the particle arrays are contiguous, no need to go via the cells)
+	#pragma omp for schedule(static)
+	for (int p = 0; p < num_particles; p++) {
+		kick_drift(p);
+	}
+}
+
+// the (flattened) index of the cell each particle should be in after update_cells
+static int * part_cell = NULL;
+
+/**
+ * @brief Work out which cell a particle (in cell i, j) should now be in, recording it in part_cell. If it has
+ *        left its cell, its coordinates are shifted into the frame of the new cell.
+ * 
+ * @param p The particle
+ * @param i The x index of the cell it is in
+ * @param j The y index of the cell it is in
+ * @return int Whether the particle has moved cell
+ */
+static inline int classify_particle(int p, int i, int j) {
+	// if a particles x or y value is greater than the cell size or less than 0, it must have moved cell
+	if ((parts.x[p] < 0.0) | (parts.x[p] >= cell_size) | (parts.y[p] < 0.0) | (parts.y[p] >= cell_size)) {
+		// do a quick check to make sure its not moved 2 cells (since this means our time step is too large, or something else is going wrong)
+		if ((parts.x[p] < (-cell_size)) || (parts.x[p] >= (2*cell_size)) || (parts.y[p] < (-cell_size)) || (parts.y[p] >= (2*cell_size))) {
+			fprintf(stderr, "A particle has moved more than one cell!\n");
+			exit(1);
 		}
+
+		// work out whether we've moved a cell in the x and the y dimension
+		int x_shift = (parts.x[p] < 0.0) ? -1 : (parts.x[p] >= cell_size) ? +1 : 0;
+		int y_shift = (parts.y[p] < 0.0) ? -1 : (parts.y[p] >= cell_size) ? +1 : 0;
+		
+		// the new i and j are +/- 1 in each dimension,
+		// but if that means we go out of simulation bounds, wrap it to x and 1
+		int new_i = i+x_shift;
+		if (new_i == 0) { new_i = x; }
+		if (new_i == x+1) { new_i = 1; }
+		int new_j = j+y_shift;
+		if (new_j == 0) { new_j = y; }
+		if (new_j == y+1) { new_j = 1; }
+		// update x and y coordinates (i.e. remove the additional cell size)
+		parts.x[p] = parts.x[p] + (x_shift * -cell_size);
+		parts.y[p] = parts.y[p] + (y_shift * -cell_size);
+
+		part_cell[p] = new_i * (y+2*halo) + new_j;
+		return 1;
+	}
+	part_cell[p] = i * (y+2*halo) + j;
+	return 0;
+}
+
+/**
+ * @brief Allocate part_cell (on first use) and reset the count of moved particles, before classifying the particles
+ * 
+ */
+static void start_cell_update() {
+	#pragma omp single
+	{
+		if (part_cell == NULL) {
+			part_cell = (int *) malloc(num_particles * sizeof(int));
+		}
+		moved_total = 0;
 	}
 }
 
@@ -119,51 +433,28 @@ void move_particles() {
  * @brief This routine updates the cell lists. If a particles coordinates are not within a cell
  *        any more, this function calculates the cell it should be in and performs the move.
  *        If a particle moves more than 1 cell in any direction, this indicates poor settings
- *        and therefore an error is generated.
+ *        and therefore an error is generated. Moved particles are put back into cell order
+ *        by sorting the particle arrays.
  * 
  */
 void update_cells() {
-	// move particles that need to move cell lists
-	#pragma omp parallel for collapse(2) 
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			struct particle_t * p_next;
-			while (p != NULL) {
-				// we have to store the next particle here, as the remove/add at the end may be destructive
-				p_next = p->next;
-				// if a particles x or y value is greater than the cell size or less than 0, it must have moved cell
-				// do a quick check to make sure its not moved 2 cells (since this means our time step is too large, or something else is going wrong)
-				if ((p->x < 0.0) | (p->x >= cell_size) | (p->y < 0.0) | (p->y >= cell_size)) {
-					if ((p->x < (-cell_size)) || (p->x >= (2*cell_size)) || (p->y < (-cell_size)) || (p->y >= (2*cell_size))) {
-						fprintf(stderr, "A particle has moved more than one cell!\n");
-						exit(1);
-					}
-
-					// work out whether we've moved a cell in the x and the y dimension
-					int x_shift = (p->x < 0.0) ? -1 : (p->x >= cell_size) ? +1 : 0;
-					int y_shift = (p->y < 0.0) ? -1 : (p->y >= cell_size) ? +1 : 0;
-					
-					// the new i and j are +/- 1 in each dimension,
-					// but if that means we go out of simulation bounds, wrap it to x and 1
-					int new_i = i+x_shift;
-					if (new_i == 0) { new_i = x; }
-					if (new_i == x+1) { new_i = 1; }
-					int new_j = j+y_shift;
-					if (new_j == 0) { new_j = y; }
-					if (new_j == y+1) { new_j = 1; }
-					// update x and y coordinates (i.e. remove the additional cell size)
-					p->x = p->x + (x_shift * -cell_size);
-					p->y = p->y + (y_shift * -cell_size);
-
-					// remove the particle from its current cell list, then add it to the new cell list
-					remove_particle(&(cells[i][j]), p);
-					add_particle(&(cells[new_i][new_j]), p);
-				}
-				p = p_next;
-			}
+	start_cell_update();
+
+	// work out the cell each particle should be in
+	#pragma omp for schedule(static) reduction(|:moved_total)
+	for (int n = 0; n < x * y; n++) {
+		int i = cell_order[n] / (y+2*halo);
+		int j = cell_order[n] % (y+2*halo);
+		struct cell_list * c = &(cells[i][j]);
+		for (int p = c->start; p < c->start + c->count; p++) {
+			moved_total |= classify_particle(p, i, j);
 		}
 	}
+
+	// move the particles into their new cells (only needed if any have changed cell)
+	if (moved_total) {
+		sort_particles(part_cell);
+	}
 }
 
 /**
@@ -171,30 +462,98 @@ void update_cells() {
  *        half step, since its already done half a time step in the move_particles routine). Additionally, this
  *        function calculated the kinetic energy of the system.
  * 
- * @return double The kinetic energy
+ * @param energy Whether to calculate the kinetic energy (otherwise 0 is returned)
+ * @return double The kinetic energy (on every thread)
  */
-double update_velocity() {
-	double kinetic_energy = 0.0;
-	#pragma omp parallel for collapse(2) reduction(+:kinetic_energy)
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				// update velocity again by half time to obtain v(t + Dt)
-				p->vx += dth * p->ax;
-				p->vy += dth * p->ay;
-
-				// calculate the kinetic energy by adding up the squares of the velocities in each dim
-				kinetic_energy += (p->vx * p->vx) + (p->vy * p->vy);
-
-				p = p->next;
+double update_velocity(int energy) {
+	#pragma omp single
+	kinetic_energy_total = 0.0;
+
+	#pragma omp for schedule(static) reduction(+:kinetic_energy_total)
+	for (int p = 0; p < num_particles; p++) {
+		// update velocity again by half time to obtain v(t + Dt)
+		parts.vx[p] += dth * parts.ax[p];
+		parts.vy[p] += dth * parts.ay[p];
+
+		// calculate the kinetic energy by adding up the squares of the velocities in each dim
+		if (energy) {
+			kinetic_energy_total += (parts.vx[p] * parts.vx[p]) + (parts.vy[p] * parts.vy[p]);
+		}
+	}
+
+	// KE = (1/2)mv^2
+	return kinetic_energy_total * (0.5 / num_particles);
+}
+
+/**
+ * @brief The first half of the fused integrator. This gives each particle its first half-kick, moves it for a
+ *        whole time step and checks whether it has left its cell, all in one pass over the cells (rather than
+ *        the separate passes of move_particles and update_cells). With neighbour lists, particles stay in their
+ *        cells until the lists expire, so this measures how far each particle has moved instead (as in
+ *        neighbour_lists_expired), and the cells are updated separately once they have.
+ * 
+ * @return int Whether the cells have changed (with cell lists) or the neighbour lists have expired
+ */
+static int kick_drift_classify() {
+	if (skin > 0.0) {
+		#pragma omp single
+		max_disp_2_total = 0.0;
+
+		#pragma omp for schedule(static) reduction(max:max_disp_2_total)
+		for (int p = 0; p < num_particles; p++) {
+			kick_drift(p);
+
+			double dx = parts.x[p] - nbrs.x0[p];
+			double dy = parts.y[p] - nbrs.y0[p];
+			double disp_2 = dx*dx + dy*dy;
+			if (disp_2 > max_disp_2_total) {
+				max_disp_2_total = disp_2;
 			}
 		}
+		return max_disp_2_total > (0.25 * skin * skin);
 	}
 
+	start_cell_update();
+
+	#pragma omp for schedule(static) reduction(|:moved_total)
+	for (int n = 0; n < x * y; n++) {
+		int i = cell_order[n] / (y+2*halo);
+		int j = cell_order[n] % (y+2*halo);
+		struct cell_list * c = &(cells[i][j]);
+		for (int p = c->start; p < c->start + c->count; p++) {
+			kick_drift(p);
+			moved_total |= classify_particle(p, i, j);
+		}
+	}
+
+	if (moved_total) {
+		sort_particles(part_cell);
+	}
+	return moved_total;
+}
+
+/**
+ * @brief The second half of the fused integrator. This calculates the acceleration of each particle (as in
+ *        comp_accel) and, where the acceleration of each particle is complete as soon as it has been evaluated
+ *        (i.e. without the half-shell stencil), updates its velocity and kinetic energy in the same loop. With
+ *        the half-shell stencil, this falls back to a separate update_velocity pass.
+ * 
+ * @param energy Whether to calculate the energies (as in comp_accel)
+ * @param kinetic_energy Set to the kinetic energy (on every thread)
+ * @return double The potential energy (on every thread)
+ */
+static double comp_accel_kick(int energy, double * kinetic_energy) {
+	if (half_shell) {
+		double pot_energy = comp_accel(energy);
+		*kinetic_energy = update_velocity(energy);
+		return pot_energy;
+	}
+
+	double pot_energy = (skin > 0.0) ? comp_accel_neighbour_lists(energy, 1) : comp_accel_full_shell(energy, 1);
+
 	// KE = (1/2)mv^2
-	kinetic_energy *= (0.5 / num_particles);
-	return kinetic_energy;
+	*kinetic_energy = kinetic_energy_total * (0.5 / num_particles);
+	return pot_energy;
 }
 
 /**
@@ -215,60 +574,123 @@ int main(int argc, char *argv[]) {
 	parse_args(argc, argv);
 	// call set up to update defaults
 	setup();
+	// choose the force kernels once, based on the potential and what this CPU supports
+	select_kernel();
 
 	if (verbose) print_opts();
 	
 	// set up problem
 	problem_setup();
 
-	// apply boundary condition (i.e. update pointers on the boundarys to loop periodically)
-	apply_boundary();
-	
-	comp_accel();
-
 	double potential_energy = 0.0;
 	double kinetic_energy = 0.0;
+	double initial_energy = 0.0;
 
 	int iters = 0;
-	double t;
+	double t = 0.0;
 
 	// calculate value outside loop to be used for temp calculation
 	double placeholder = 2.0 / 3.0;
 
-	for (t = 0.0; t < t_end; t+=dt, iters++) {
-		// move particles half a time step
-		move_particles();
+	// run the whole simulation in one parallel region, rather than starting one for every loop. Every
+	// thread runs the time loop, and the routines share their loops between the threads.
+	#pragma omp parallel
+	{
+		// apply boundary condition (i.e. copy the particles on the boundarys into the ghost cells, to loop periodically)
+		apply_boundary();
 
-		// update cell lists (i.e. move any particles between cell lists if required)
-		update_cells();
+		if (skin > 0.0) build_neighbour_lists();
 
-		// update pointers (because the previous operation might break boundary cell lists)
-		apply_boundary();
-		
-		// compute acceleration for each particle and calculate potential energy
-		potential_energy = comp_accel();
+		comp_accel(0);
 
-		// update velocity based on the acceleration and calculate the kinetic energy
-		kinetic_energy = update_velocity();
-	
-		if (iters % output_freq == 0) {
-			// calculate temperature and total energy
-			double total_energy = kinetic_energy + potential_energy;
-			double temp = kinetic_energy * placeholder;
-
-			printf("Step %8d, Time: %14.8e (dt: %14.8e), Total energy: %14.8e (p:%14.8e,k:%14.8e), Temp: %14.8e\n", iters, t+dt, dt, total_energy, potential_energy, kinetic_energy, temp);
- 
-			// if output is enabled and checkpointing is enabled, write out
-            if ((!no_output) && (enable_checkpoints))
-                write_checkpoint(iters, t+dt);
+		// each thread keeps its own copy of the step and energies (which are the same on every thread)
+		double step_potential = 0.0;
+		double step_kinetic = 0.0;
+		int step = 0;
+		double time;
+
+		for (time = 0.0; time < t_end; time+=dt, step++) {
+			// the energies are only needed on the steps they are reported (and the last step)
+			int energy = (step % output_freq == 0) || !(time + dt < t_end);
+
+			if (fused) {
+				// move particles half a time step and check their cells in one pass
+				if (kick_drift_classify()) {
+					if (skin > 0.0) update_cells();
+
+					apply_boundary();
+
+					if (skin > 0.0) build_neighbour_lists();
+				} else {
+					// the ghost cells are the same, but their particles have moved
+					update_halo();
+				}
+
+				// compute acceleration and update velocity in one pass, calculating both energies
+				step_potential = comp_accel_kick(energy, &step_kinetic);
+			} else {
+				// move particles half a time step
+				move_particles();
+
+				// with neighbour lists, particles stay in their cells until the lists expire
+				if ((skin == 0.0) || neighbour_lists_expired()) {
+					// update cell lists (i.e. move any particles between cell lists if required)
+					update_cells();
+
+					// update ghost cells (because the previous operation might have changed the boundary cells)
+					apply_boundary();
+
+					if (skin > 0.0) build_neighbour_lists();
+				} else {
+					// the ghost cells are the same, but their particles have moved
+					update_halo();
+				}
+
+				// compute acceleration for each particle and calculate potential energy
+				step_potential = comp_accel(energy);
+
+				// update velocity based on the acceleration and calculate the kinetic energy
+				step_kinetic = update_velocity(energy);
+			}
+
+			if (step % output_freq == 0) {
+				#pragma omp single
+				{
+					// calculate temperature and total energy
+					double total_energy = step_kinetic + step_potential;
+					double temp = step_kinetic * placeholder;
+
+					printf("Step %8d, Time: %14.8e (dt: %14.8e), Total energy: %14.8e (p:%14.8e,k:%14.8e), Temp: %14.8e\n", step, time+dt, dt, total_energy, step_potential, step_kinetic, temp);
+
+					// keep the first total energy, to measure the drift from
+					if (step == 0) initial_energy = total_energy;
+
+					// if output is enabled and checkpointing is enabled, write out
+					if ((!no_output) && (enable_checkpoints))
+						write_checkpoint(step, time+dt);
+				}
+			}
+		}
+
+		#pragma omp master
+		{
+			potential_energy = step_potential;
+			kinetic_energy = step_kinetic;
+			iters = step;
+			t = time;
 		}
 	}
 
 	// calculate the final energy and write out a final status message
 	double final_energy = kinetic_energy + potential_energy;
 	printf("Step %8d, Time: %14.8e, Final energy: %14.8e\n", iters, t, final_energy);
+	printf("Energy drift since step 0: %14.8e\n", (final_energy - initial_energy) / fabs(initial_energy));
     printf("Simulation complete.\n");
 
+	if (skin > 0.0) {
+		printf("Neighbour lists built %d times (every %.2lf steps on average)\n", nbrs.num_builds, (double) iters / nbrs.num_builds);
+	}
+
 	// if output is enabled, write the mesh file and the final state
 	if (!no_output) {
 		write_mesh();
@@ -282,6 +704,13 @@ int main(int argc, char *argv[]) {
 
 	printf("The calculation took: %.10lf seconds\n", end_time - start_time);
 
+	// free everything allocated during the run
+	free(part_cell);
+	free_neighbour_lists();
+	free_neighbourhoods();
+	free_potential_table();
+	problem_teardown();
+
 	return 0;
 }
 
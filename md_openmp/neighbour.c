@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "args.h"
+#include "data.h"
+#include "neighbour.h"
+#include "order.h"
+#include "stencil.h"
+
+// the neighbour lists
+struct neighbour_list nbrs;
+
+/**
+ * @brief Find the particles within the cut off plus skin of a particle, by searching the cells around it.
+ *        With the half-shell stencil, only the forward cells are searched (and the particle's own cell
+ *        only for particles after it), so each pair is only listed once. Each neighbour's shift indexes
+ *        the offset of its cell, i.e. (a+halo) * (2*halo+1) + (b+halo).
+ * 
+ * @param i The x index of the particle's cell
+ * @param j The y index of the particle's cell
+ * @param p The particle
+ * @param index Where to store the neighbours (or NULL to only count them)
+ * @param shift Where to store the shift of each neighbour (or NULL to only count them)
+ * @return int The number of neighbours found
+ */
+static int find_neighbours(int i, int j, int p, int * index, unsigned char * shift) {
+	double r_list = r_cut_off + skin;
+	double r_list_2 = r_list * r_list;
+
+	int width = 2*halo+1;
+	int num = 0;
+	for (int s = 0; s < width * width; s++) {
+		int a = s / width - halo;
+		int b = s % width - halo;
+		if (!stencil_reaches(a, b) || (half_shell && !((a > 0) || ((a == 0) && (b >= 0))))) {
+			continue;
+		}
+
+		struct cell_list * n = &(cells[i+a][j+b]);
+		int q_start = (half_shell && (a == 0) && (b == 0)) ? p+1 : n->start;
+		for (int q = q_start; q < n->start + n->count; q++) {
+			if (p == q) {
+				continue;
+			}
+
+			double dx = parts.x[p] - parts.x[q] + nbrs.shift_x[s];
+			double dy = parts.y[p] - parts.y[q] + nbrs.shift_y[s];
+			if (dx*dx + dy*dy < r_list_2) {
+				if (index != NULL) {
+					index[num] = q;
+					shift[num] = s;
+				}
+				num++;
+			}
+		}
+	}
+	return num;
+}
+
+/**
+ * @brief Build the neighbour lists from the cell lists. This counts the neighbours of each particle, so
+ *        that the lists can be stored contiguously, then fills them in. The positions of the particles are
+ *        recorded, so that we can tell when the lists need rebuilding. This is called from within the
+ *        parallel region.
+ * 
+ */
+void build_neighbour_lists() {
+	#pragma omp single
+	if (nbrs.start == NULL) {
+		nbrs.start = (int *) malloc((num_particles + 1) * sizeof(int));
+		nbrs.x0 = (double *) malloc(num_particles * sizeof(double));
+		nbrs.y0 = (double *) malloc(num_particles * sizeof(double));
+		int width = 2*halo+1;
+		for (int s = 0; s < width * width; s++) {
+			nbrs.shift_x[s] = -(s / width - halo) * cell_size;
+			nbrs.shift_y[s] = -(s % width - halo) * cell_size;
+			nbrs.shift_xf[s] = (float) nbrs.shift_x[s];
+			nbrs.shift_yf[s] = (float) nbrs.shift_y[s];
+		}
+
+	}
+
+	// the single precision positions include the ghost copies, so they grow with the particle data
+	#pragma omp single
+	if (mixed_precision && (nbrs.single_capacity < parts.capacity)) {
+		free(nbrs.xf);
+		free(nbrs.yf);
+		nbrs.single_capacity = parts.capacity;
+		nbrs.xf = (float *) malloc(nbrs.single_capacity * sizeof(float));
+		nbrs.yf = (float *) malloc(nbrs.single_capacity * sizeof(float));
+	}
+
+	// count the neighbours of each particle
+	#pragma omp for schedule(static)
+	for (int n = 0; n < x * y; n++) {
+		int i = cell_order[n] / (y+2*halo);
+		int j = cell_order[n] % (y+2*halo);
+		struct cell_list * c = &(cells[i][j]);
+		for (int p = c->start; p < c->start + c->count; p++) {
+			nbrs.start[p+1] = find_neighbours(i, j, p, NULL, NULL);
+		}
+	}
+
+	#pragma omp single
+	{
+		nbrs.start[0] = 0;
+		for (int p = 0; p < num_particles; p++) {
+			nbrs.start[p+1] += nbrs.start[p];
+		}
+
+		// grow the lists if needed (with some room to spare, so this is rare)
+		if (nbrs.start[num_particles] > nbrs.capacity) {
+			nbrs.capacity = nbrs.start[num_particles] + nbrs.start[num_particles] / 4;
+			free(nbrs.index);
+			free(nbrs.shift);
+			nbrs.index = (int *) malloc(nbrs.capacity * sizeof(int));
+			nbrs.shift = (unsigned char *) malloc(nbrs.capacity * sizeof(unsigned char));
+		}
+
+		nbrs.num_builds++;
+	}
+
+	// fill in the lists and record the current positions
+	#pragma omp for schedule(static)
+	for (int n = 0; n < x * y; n++) {
+		int i = cell_order[n] / (y+2*halo);
+		int j = cell_order[n] % (y+2*halo);
+		struct cell_list * c = &(cells[i][j]);
+		for (int p = c->start; p < c->start + c->count; p++) {
+			find_neighbours(i, j, p, &(nbrs.index[nbrs.start[p]]), &(nbrs.shift[nbrs.start[p]]));
+			nbrs.x0[p] = parts.x[p];
+			nbrs.y0[p] = parts.y[p];
+		}
+	}
+}
+
+// the largest squared displacement since the lists were built (shared, so it can be reduced from within the parallel region)
+static double max_disp_2;
+
+/**
+ * @brief Check whether the neighbour lists need rebuilding, i.e. whether any particle has moved
+ *        more than half the skin since they were built (as two particles could then have closed
+ *        the whole skin between them).
+ * 
+ * @return int Whether the neighbour lists need rebuilding (on every thread)
+ */
+int neighbour_lists_expired() {
+	#pragma omp single
+	max_disp_2 = 0.0;
+
+	#pragma omp for schedule(static) reduction(max:max_disp_2)
+	for (int p = 0; p < num_particles; p++) {
+		double dx = parts.x[p] - nbrs.x0[p];
+		double dy = parts.y[p] - nbrs.y0[p];
+		double disp_2 = dx*dx + dy*dy;
+		if (disp_2 > max_disp_2) {
+			max_disp_2 = disp_2;
+		}
+	}
+	return max_disp_2 > (0.25 * skin * skin);
+}
+
+/**
+ * @brief Update the single precision copies of the positions (used by the mixed precision kernels), including
+ *        those of the ghost copies
+ * 
+ */
+void update_single_positions() {
+	#pragma omp for schedule(static)
+	for (int p = 0; p < num_particles + num_ghosts; p++) {
+		nbrs.xf[p] = (float) parts.x[p];
+		nbrs.yf[p] = (float) parts.y[p];
+	}
+}
+
+/**
+ * @brief Free the neighbour lists (if they were built)
+ * 
+ */
+void free_neighbour_lists() {
+	free(nbrs.start);
+	free(nbrs.index);
+	free(nbrs.shift);
+	free(nbrs.x0);
+	free(nbrs.y0);
+	free(nbrs.xf);
+	free(nbrs.yf);
+	memset(&nbrs, 0, sizeof(struct neighbour_list));
+}
@@ -0,0 +1,28 @@
+#ifndef NEIGHBOUR_H
+#define NEIGHBOUR_H
+
+#include "stencil.h"
+
+// Verlet neighbour lists (i.e. for each particle, the particles within the cut off plus a skin).
+// Each neighbour is stored with a shift, which indexes the offset between the two particles' cells
+struct neighbour_list {
+	int * start; // where each particle's neighbours start (with num_particles+1 entries)
+	int * index; // the neighbouring particles
+	unsigned char * shift; // the cell offset of each neighbour
+	int capacity;
+	double shift_x[MAX_STENCIL], shift_y[MAX_STENCIL]; // the offset (in x and y) of each possible shift
+	float shift_xf[MAX_STENCIL], shift_yf[MAX_STENCIL]; // single precision offsets (for mixed precision)
+	float * xf, * yf; // single precision copies of the positions, including the ghost copies (for mixed precision)
+	int single_capacity; // the number of single precision positions there is room for
+	double * x0, * y0; // the positions of the particles when the lists were built
+	int num_builds;
+};
+
+extern struct neighbour_list nbrs;
+
+void build_neighbour_lists();
+void update_single_positions();
+int neighbour_lists_expired();
+void free_neighbour_lists();
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "order.h"
+
+// the chosen cell ordering
+int cell_ordering = ORDER_ROW;
+
+// the (flattened) index of each interior cell, in the order the cells are stored and visited
+int * cell_order = NULL;
+
+// a cell and its position along the curve (used to sort the cells)
+struct cell_key {
+	unsigned long key;
+	int cell;
+};
+
+/**
+ * @brief Convert an ordering name (as given on the command line) into an ordering
+ * 
+ * @param name The name of the ordering
+ * @return int The ordering, or -1 if the name is not recognised
+ */
+int parse_ordering(char * name) {
+	for (int o = ORDER_ROW; o <= ORDER_HILBERT; o++) {
+		if (strcmp(name, ordering_name(o)) == 0) {
+			return o;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Get the name of an ordering
+ * 
+ * @param o The ordering
+ * @return const char* The name of the ordering
+ */
+const char * ordering_name(int o) {
+	switch (o) {
+		case ORDER_MORTON: return "morton";
+		case ORDER_HILBERT: return "hilbert";
+		default: return "row";
+	}
+}
+
+/**
+ * @brief Get the position of a cell along the Morton (Z-order) curve, by interleaving the bits of its coordinates
+ * 
+ * @param i The x coordinate
+ * @param j The y coordinate
+ * @return unsigned long The position along the curve
+ */
+static unsigned long morton_key(unsigned int i, unsigned int j) {
+	unsigned long key = 0;
+	for (int b = 0; b < 32; b++) {
+		key |= ((unsigned long) ((i >> b) & 1) << (2*b + 1)) | ((unsigned long) ((j >> b) & 1) << (2*b));
+	}
+	return key;
+}
+
+/**
+ * @brief Get the position of a cell along the Hilbert curve that fills an n by n square
+ * 
+ * @param n The size of the square (a power of two)
+ * @param i The x coordinate
+ * @param j The y coordinate
+ * @return unsigned long The position along the curve
+ */
+static unsigned long hilbert_key(unsigned int n, unsigned int i, unsigned int j) {
+	unsigned long key = 0;
+	for (unsigned int s = n / 2; s > 0; s /= 2) {
+		unsigned int ri = (i & s) > 0;
+		unsigned int rj = (j & s) > 0;
+		key += (unsigned long) s * s * ((3 * ri) ^ rj);
+
+		// rotate the quadrant, so the curve within it runs the right way
+		if (rj == 0) {
+			if (ri == 1) {
+				i = n - 1 - i;
+				j = n - 1 - j;
+			}
+			unsigned int t = i;
+			i = j;
+			j = t;
+		}
+	}
+	return key;
+}
+
+/**
+ * @brief Compare two cells by their position along the curve (for qsort)
+ */
+static int compare_keys(const void * a, const void * b) {
+	unsigned long ka = ((const struct cell_key *) a)->key;
+	unsigned long kb = ((const struct cell_key *) b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+/**
+ * @brief Work out the order the interior cells are stored and visited in. With a space-filling curve,
+ *        the curve fills the smallest power of two square that covers the grid, and cells outside of
+ *        the grid are skipped, so cells close together in the grid stay close together in memory.
+ * 
+ */
+void build_cell_order() {
+	cell_order = (int *) malloc(x * y * sizeof(int));
+
+	unsigned int n = 1;
+	while ((n < (unsigned int) x) || (n < (unsigned int) y)) {
+		n *= 2;
+	}
+
+	struct cell_key * keys = (struct cell_key *) malloc(x * y * sizeof(struct cell_key));
+	int k = 0;
+	for (int i = 1; i < x+1; i++) {
+		for (int j = 1; j < y+1; j++) {
+			keys[k].cell = i * (y+2*halo) + j;
+			switch (cell_ordering) {
+				case ORDER_MORTON: keys[k].key = morton_key(i-1, j-1); break;
+				case ORDER_HILBERT: keys[k].key = hilbert_key(n, i-1, j-1); break;
+				default: keys[k].key = k; break;
+			}
+			k++;
+		}
+	}
+
+	qsort(keys, x * y, sizeof(struct cell_key), compare_keys);
+	for (int k = 0; k < x * y; k++) {
+		cell_order[k] = keys[k].cell;
+	}
+	free(keys);
+}
+
+/**
+ * @brief Free the cell order
+ * 
+ */
+void free_cell_order() {
+	free(cell_order);
+	cell_order = NULL;
+}
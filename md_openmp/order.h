@@ -0,0 +1,17 @@
+#ifndef ORDER_H
+#define ORDER_H
+
+// the orders the cells (and so their particles) can be stored and visited in
+#define ORDER_ROW 0
+#define ORDER_MORTON 1
+#define ORDER_HILBERT 2
+
+extern int cell_ordering;
+extern int * cell_order;
+
+int parse_ordering(char * name);
+const char * ordering_name(int o);
+void build_cell_order();
+void free_cell_order();
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef PAIR_H
+#define PAIR_H
+
+#include <math.h>
+
+#include "data.h"
+#include "potential.h"
+
+// the forms of pair evaluation a kernel can be specialised for
+#define PAIR_LJ 0 // Lennard-Jones, with the cut off given at run time
+#define PAIR_LJ_DEFAULT 1 // Lennard-Jones, with the default cut off
+#define PAIR_WCA 2 // Lennard-Jones, cut off at its minimum
+#define PAIR_TABLE 3 // the potential table
+
+// the default Lennard-Jones cut off
+#define LJ_DEFAULT_CUT_OFF 2.5
+
+// the constants used to evaluate a pair
+struct pair_constants {
+	double r_cut_off;
+	double r_cut_off_2;
+	double Uc;
+	double Duc;
+	double table_r_2_min;
+	double table_inv_dr_2;
+	const double * table_coeffs;
+};
+
+/**
+ * @brief Get the constants of the shifted-force Lennard-Jones potential for a cut off (calculated in
+ *        the same way as in setup). When the cut off is a constant, this is evaluated by the compiler.
+ * 
+ * @param cut_off The cut off
+ * @return struct pair_constants The constants
+ */
+static inline struct pair_constants lj_constants(const double cut_off) {
+	double r_cut_off_2_inv = 1.0 / (cut_off * cut_off);
+	double r_cut_off_6_inv = r_cut_off_2_inv * r_cut_off_2_inv * r_cut_off_2_inv;
+
+	struct pair_constants c = {0};
+	c.r_cut_off = cut_off;
+	c.r_cut_off_2 = cut_off * cut_off;
+	c.Uc = 4.0 * r_cut_off_6_inv * (r_cut_off_6_inv - 1.0);
+	c.Duc = -48 * r_cut_off_6_inv * (r_cut_off_6_inv - 0.5) / cut_off;
+	return c;
+}
+
+/**
+ * @brief Get the constants for a form of pair evaluation. The forms with a fixed cut off become
+ *        immediates in the kernels, the others are read once per call (rather than once per pair).
+ * 
+ * @param form The form of pair evaluation (a constant)
+ * @return struct pair_constants The constants
+ */
+static inline __attribute__((always_inline)) struct pair_constants pair_constants(const int form) {
+	if (form == PAIR_LJ_DEFAULT) {
+		return lj_constants(LJ_DEFAULT_CUT_OFF);
+	} else if (form == PAIR_WCA) {
+		return lj_constants(WCA_CUT_OFF);
+	}
+
+	struct pair_constants c;
+	c.r_cut_off = r_cut_off;
+	c.r_cut_off_2 = r_cut_off_2;
+	c.Uc = Uc;
+	c.Duc = Duc;
+	c.table_r_2_min = table.r_2_min;
+	c.table_inv_dr_2 = table.inv_dr_2;
+	c.table_coeffs = table.coeffs;
+	return c;
+}
+
+/**
+ * @brief Evaluate the Lennard-Jones potential for a single pair. If the pair is within the cut off, the
+ *        acceleration and potential energy are added to the totals for the first particle and, if newton
+ *        is set, the opposite acceleration is applied to the second particle. Without with_energy, only
+ *        the acceleration is calculated (which saves the square root).
+ *
+ * @param c The constants of the potential
+ * @param dx The distance between the particles in x
+ * @param dy The distance between the particles in y
+ * @param newton Whether to apply the opposite acceleration to the second particle
+ * @param ax The x acceleration of the first particle
+ * @param ay The y acceleration of the first particle
+ * @param q_ax The x acceleration of the second particle
+ * @param q_ay The y acceleration of the second particle
+ * @param energy The potential energy
+ * @param with_energy Whether to calculate the potential energy (a constant)
+ */
+static inline __attribute__((always_inline)) void lj_pair(const struct pair_constants c, double dx, double dy, int newton, double * ax, double * ay, double * q_ax, double * q_ay, double * energy, const int with_energy) {
+	double r_2 = dx*dx + dy*dy;
+	if (r_2 < c.r_cut_off_2) {
+		double r_2_inv = 1.0 / r_2;
+		double r_6_inv = r_2_inv * r_2_inv * r_2_inv;
+
+		double f = (48.0 * r_2_inv * r_6_inv * (r_6_inv - 0.5));
+
+		*ax += f*dx;
+		*ay += f*dy;
+		if (newton) {
+			*q_ax -= f*dx;
+			*q_ay -= f*dy;
+		}
+
+		if (with_energy) {
+			*energy += 4.0 * r_6_inv * (r_6_inv - 1.0) - c.Uc - c.Duc * (sqrt(r_2) - c.r_cut_off);
+		}
+	}
+}
+
+/**
+ * @brief Evaluate the tabulated potential for a single pair (see lj_pair). The force and energy are
+ *        interpolated from the interval of the table that r^2 falls in.
+ */
+static inline __attribute__((always_inline)) void table_pair(const struct pair_constants c, double dx, double dy, int newton, double * ax, double * ay, double * q_ax, double * q_ay, double * energy, const int with_energy) {
+	double r_2 = dx*dx + dy*dy;
+	if (r_2 < c.r_cut_off_2) {
+		double s = (r_2 - c.table_r_2_min) * c.table_inv_dr_2;
+		int i = (int) s;
+		i = (i < 0) ? 0 : ((i >= TABLE_SIZE) ? TABLE_SIZE - 1 : i);
+		double t = s - i;
+		const double * coeffs = &(c.table_coeffs[8*i]);
+
+		double f = coeffs[0] + t * (coeffs[1] + t * (coeffs[2] + t * coeffs[3]));
+
+		*ax += f*dx;
+		*ay += f*dy;
+		if (newton) {
+			*q_ax -= f*dx;
+			*q_ay -= f*dy;
+		}
+
+		if (with_energy) {
+			*energy += coeffs[4] + t * (coeffs[5] + t * (coeffs[6] + t * coeffs[7]));
+		}
+	}
+}
+
+/**
+ * @brief Evaluate a single pair in the given form
+ */
+static inline __attribute__((always_inline)) void evaluate_pair(const int form, const struct pair_constants c, double dx, double dy, int newton, double * ax, double * ay, double * q_ax, double * q_ay, double * energy, const int with_energy) {
+	if (form == PAIR_TABLE) {
+		table_pair(c, dx, dy, newton, ax, ay, q_ax, q_ay, energy, with_energy);
+	} else {
+		lj_pair(c, dx, dy, newton, ax, ay, q_ax, q_ay, energy, with_energy);
+	}
+}
+
+/**
+ * @brief Define the kernels for each instruction set for a form of pair evaluation, named after
+ *        the instruction set with the given suffix (e.g. range_kernel_avx2_wca). Each kernel also has
+ *        a forces-only version, which leaves the energy alone (e.g. range_forces_avx2_wca).
+ */
+#define DEFINE_KERNELS_SCALAR(suffix, form) \
+	static void range_kernel_scalar##suffix(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_scalar(px, py, nh, first, skip, newton, ax, ay, energy, form, 1); \
+	} \
+	static void range_forces_scalar##suffix(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_scalar(px, py, nh, first, skip, newton, ax, ay, energy, form, 0); \
+	} \
+	static void list_kernel_scalar##suffix(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_scalar(px, py, index, shift, num, newton, ax, ay, energy, form, 1); \
+	} \
+	static void list_forces_scalar##suffix(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_scalar(px, py, index, shift, num, newton, ax, ay, energy, form, 0); \
+	}
+
+#define DEFINE_KERNELS_SIMD(isa, isa_target, suffix, form) \
+	__attribute__((target(isa_target))) \
+	static void range_kernel_##isa##suffix(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_##isa(px, py, nh, first, skip, newton, ax, ay, energy, form, 1); \
+	} \
+	__attribute__((target(isa_target))) \
+	static void range_forces_##isa##suffix(double px, double py, struct neighbourhood * nh, int first, int skip, int newton, double * ax, double * ay, double * energy) { \
+		range_##isa(px, py, nh, first, skip, newton, ax, ay, energy, form, 0); \
+	} \
+	__attribute__((target(isa_target))) \
+	static void list_kernel_##isa##suffix(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_##isa(px, py, index, shift, num, newton, ax, ay, energy, form, 1); \
+	} \
+	__attribute__((target(isa_target))) \
+	static void list_forces_##isa##suffix(double px, double py, const int * index, const unsigned char * shift, int num, int newton, double * ax, double * ay, double * energy) { \
+		list_##isa(px, py, index, shift, num, newton, ax, ay, energy, form, 0); \
+	}
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "data.h"
+#include "potential.h"
+
+// the chosen potential and table interpolation
+int potential = POTENTIAL_LJ;
+int table_type = TABLE_NONE;
+
+// the potential table
+struct potential_table table;
+
+// the smallest distance covered by the table (closer pairs use the first interval)
+#define TABLE_R_MIN 0.5
+
+// parameters for the Morse potential (well depth, width and equilibrium distance)
+#define MORSE_D 1.0
+#define MORSE_A 3.0
+#define MORSE_R0 1.122462048309373
+
+/**
+ * @brief The Lennard-Jones potential, 4(r^-12 - r^-6)
+ */
+static double lj_u(double r) {
+	double r_6_inv = 1.0 / pow(r, 6);
+	return 4.0 * r_6_inv * (r_6_inv - 1.0);
+}
+
+static double lj_du(double r) {
+	double r_6_inv = 1.0 / pow(r, 6);
+	return -48.0 * r_6_inv * (r_6_inv - 0.5) / r;
+}
+
+/**
+ * @brief The Weeks-Chandler-Andersen potential, i.e. Lennard-Jones cut off at its minimum and
+ *        shifted up to zero there (so it is purely repulsive)
+ */
+static double wca_u(double r) {
+	return lj_u(r) + 1.0;
+}
+
+/**
+ * @brief The Morse potential, D(e^(-2a(r - r0)) - 2e^(-a(r - r0)))
+ */
+static double morse_u(double r) {
+	double e = exp(-MORSE_A * (r - MORSE_R0));
+	return MORSE_D * (e * e - 2.0 * e);
+}
+
+static double morse_du(double r) {
+	double e = exp(-MORSE_A * (r - MORSE_R0));
+	return -2.0 * MORSE_A * MORSE_D * (e * e - e);
+}
+
+/**
+ * @brief A soft-sphere potential, r^-12
+ */
+static double soft_u(double r) {
+	return 1.0 / pow(r, 12);
+}
+
+static double soft_du(double r) {
+	return -12.0 / pow(r, 13);
+}
+
+// the potentials, in the order of their identifiers
+static struct potential potentials[] = {
+	{"lj",    lj_u,    lj_du,    0.0},
+	{"wca",   wca_u,   lj_du,    WCA_CUT_OFF},
+	{"morse", morse_u, morse_du, 0.0},
+	{"soft",  soft_u,  soft_du,  0.0}
+};
+#define NUM_POTENTIALS 4
+
+/**
+ * @brief Convert a potential name (as given on the command line) into a potential
+ * 
+ * @param name The name of the potential
+ * @return int The potential, or -1 if the name is not recognised
+ */
+int parse_potential(char * name) {
+	for (int p = 0; p < NUM_POTENTIALS; p++) {
+		if (strcmp(name, potentials[p].name) == 0) {
+			return p;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Get the name of a potential
+ * 
+ * @param p The potential
+ * @return const char* The name of the potential
+ */
+const char * potential_name(int p) {
+	return potentials[p].name;
+}
+
+/**
+ * @brief Convert a table interpolation name (as given on the command line) into a table type
+ * 
+ * @param name The name of the interpolation
+ * @return int The table type, or -1 if the name is not recognised
+ */
+int parse_table_type(char * name) {
+	if (strcmp(name, "linear") == 0) return TABLE_LINEAR;
+	if (strcmp(name, "cubic") == 0) return TABLE_CUBIC;
+	return -1;
+}
+
+/**
+ * @brief Get the name of a table type
+ * 
+ * @param t The table type
+ * @return const char* The name of the table type
+ */
+const char * table_type_name(int t) {
+	switch (t) {
+		case TABLE_LINEAR: return "linear";
+		case TABLE_CUBIC: return "cubic";
+		default: return "none";
+	}
+}
+
+/**
+ * @brief Get the cut off a potential must use
+ * 
+ * @param p The potential
+ * @return double The cut off (or 0 if any cut off can be used)
+ */
+double potential_cut_off(int p) {
+	return potentials[p].cut_off;
+}
+
+/**
+ * @brief Build the table for the chosen potential. The force (divided by r, so it can be multiplied
+ *        by dx and dy directly) and the energy are sampled at even spacings of r^2, with the energy
+ *        shifted in the same way as the Lennard-Jones kernels (so it and its derivative are zero
+ *        at the cut off). Each interval is then fitted with a line, or a cubic (Catmull-Rom) through
+ *        the samples either side of it.
+ * 
+ */
+void build_potential_table() {
+	struct potential * pot = &(potentials[potential]);
+
+	double r_2_min = TABLE_R_MIN * TABLE_R_MIN;
+	double dr_2 = (r_cut_off_2 - r_2_min) / TABLE_SIZE;
+	table.r_2_min = r_2_min;
+	table.inv_dr_2 = 1.0 / dr_2;
+
+	// sample the force and energy, with an extra sample either side of the table for the cubic fit
+	double * force = (double *) malloc((TABLE_SIZE + 3) * sizeof(double));
+	double * energy = (double *) malloc((TABLE_SIZE + 3) * sizeof(double));
+	double u_c = pot->u(r_cut_off);
+	double du_c = pot->du(r_cut_off);
+	for (int k = 0; k < TABLE_SIZE + 3; k++) {
+		double r = sqrt(r_2_min + (k-1) * dr_2);
+		force[k] = -pot->du(r) / r;
+		energy[k] = pot->u(r) - u_c - du_c * (r - r_cut_off);
+	}
+
+	table.coeffs = (double *) malloc(8 * TABLE_SIZE * sizeof(double));
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		for (int v = 0; v < 2; v++) {
+			double * s = (v == 0) ? &(force[i]) : &(energy[i]);
+			double * c = &(table.coeffs[8*i + 4*v]);
+			if (table_type == TABLE_CUBIC) {
+				c[0] = s[1];
+				c[1] = 0.5 * (s[2] - s[0]);
+				c[2] = s[0] - 2.5 * s[1] + 2.0 * s[2] - 0.5 * s[3];
+				c[3] = 0.5 * (s[3] - s[0]) + 1.5 * (s[1] - s[2]);
+			} else {
+				c[0] = s[1];
+				c[1] = s[2] - s[1];
+				c[2] = 0.0;
+				c[3] = 0.0;
+			}
+		}
+	}
+
+	free(force);
+	free(energy);
+}
+
+/**
+ * @brief Free the potential table
+ * 
+ */
+void free_potential_table() {
+	free(table.coeffs);
+	table.coeffs = NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef POTENTIAL_H
+#define POTENTIAL_H
+
+// the available pair potentials
+#define POTENTIAL_LJ 0
+#define POTENTIAL_WCA 1
+#define POTENTIAL_MORSE 2
+#define POTENTIAL_SOFT 3
+
+// the available table interpolations (TABLE_NONE uses the analytic Lennard-Jones kernels)
+#define TABLE_NONE 0
+#define TABLE_LINEAR 1
+#define TABLE_CUBIC 2
+
+// the cut off of the Weeks-Chandler-Andersen potential (the minimum of Lennard-Jones, 2^(1/6))
+#define WCA_CUT_OFF 1.122462048309373
+
+// number of intervals in a potential table
+#define TABLE_SIZE 4096
+
+// an analytic pair potential, given as the energy and its derivative at a distance r
+struct potential {
+	const char * name;
+	double (*u)(double r);
+	double (*du)(double r);
+	double cut_off; // the cut off the potential must use (or 0 to use the cut off given)
+};
+
+// a table of the force (divided by r) and shifted energy, indexed by r^2. Each interval stores
+// the coefficients of a cubic in the position within the interval, for the force then the energy
+struct potential_table {
+	double r_2_min;
+	double inv_dr_2;
+	double * coeffs;
+};
+
+extern int potential;
+extern int table_type;
+extern struct potential_table table;
+
+int parse_potential(char * name);
+const char * potential_name(int p);
+int parse_table_type(char * name);
+const char * table_type_name(int t);
+double potential_cut_off(int p);
+void build_potential_table();
+void free_potential_table();
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// the available random number generators for the initial velocities
+#define RNG_PHILOX 0 // counter-based, keyed by the seed and particle (so it can be used in any order)
+#define RNG_RAND 1 // the C library generator (a single sequence, so particles must be created in order)
+
+extern int rng;
+
+int parse_rng(char * name);
+const char * rng_name(int r);
+
+/**
+ * @brief The Philox4x32-10 counter-based generator. Each (counter, key) pair gives an independent
+ *        block of four random words, so any particle's numbers can be generated without the others.
+ * 
+ * @param ctr The counter
+ * @param key The key
+ * @param out The random words
+ */
+static inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int r = 0; r < 10; r++) {
+		uint64_t p0 = (uint64_t) 0xD2511F53u * c0;
+		uint64_t p1 = (uint64_t) 0xCD9E8D57u * c2;
+		uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+		c0 = n0;
+		c1 = (uint32_t) p1;
+		c2 = n2;
+		c3 = (uint32_t) p0;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+/**
+ * @brief Get a uniform random number in [0, 1) for a particle, which only depends on the seed and the
+ *        particle's index (and not on the order particles are created in, or the number of threads)
+ * 
+ * @param seed The seed
+ * @param index The index of the particle
+ * @return double The random number
+ */
+static inline double philox_uniform(long seed, long index) {
+	uint32_t ctr[4] = {(uint32_t) index, (uint32_t) ((uint64_t) index >> 32), 0, 0};
+	uint32_t key[2] = {(uint32_t) seed, (uint32_t) ((uint64_t) seed >> 32)};
+	uint32_t out[4];
+	philox4x32(ctr, key, out);
+	uint64_t bits = ((uint64_t) out[0] << 21) ^ (out[1] >> 11);
+	return (double) bits * (1.0 / 9007199254740992.0);
+}
+
+#endif
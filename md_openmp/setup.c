@@ -2,12 +2,42 @@
 #include <time.h>
 #include <math.h>
 #include <stdio.h> 
+#include <string.h>
 #include <omp.h>
 
 #include "setup.h"
 #include "data.h"
+#include "order.h"
+#include "potential.h"
+#include "rng.h"
+#include "stencil.h"
 #include "vtk.h"
 
+// the generator used for the initial velocities
+int rng = RNG_PHILOX;
+
+/**
+ * @brief Convert a generator name (as given on the command line) into a generator
+ * 
+ * @param name The name of the generator
+ * @return int The generator, or -1 if the name is not recognised
+ */
+int parse_rng(char * name) {
+	if (strcmp(name, "philox") == 0) return RNG_PHILOX;
+	if (strcmp(name, "rand") == 0) return RNG_RAND;
+	return -1;
+}
+
+/**
+ * @brief Get the name of a generator
+ * 
+ * @param r The generator
+ * @return const char* The name of the generator
+ */
+const char * rng_name(int r) {
+	return (r == RNG_RAND) ? "rand" : "philox";
+}
+
 /**
  * @brief Set up some default configuration options
  * 
@@ -34,69 +64,157 @@ void setup() {
 
 	dt = t_end / niters;
 	dth = dt / 2.0;
+
+	// split each cell into smaller ones (the particles are still created on the lattice of the original cells)
+	x *= split;
+	y *= split;
+	cell_size /= split;
+	build_stencil();
+
+	if (table_type != TABLE_NONE) {
+		build_potential_table();
+	}
+}
+
+/**
+ * @brief Create the particles of a cell on a regular lattice, with velocities consistent with the initial
+ *        temperature but in a random direction. The particles of every cell before this one (in row order)
+ *        must come before it, so a particle's index only depends on its cell and position in the lattice.
+ *        The cells here are those given on the command line, so when they are split the particles are put
+ *        in the middle of the cells this one is split into, and their positions are relative to the whole
+ *        cell (until they are sorted into their own cells).
+ * 
+ * @param i The x index of the (unsplit) cell
+ * @param j The y index of the (unsplit) cell
+ * @param v_magnitude The magnitude of the velocities
+ * @param v_sum_x The sum of the x velocities, which this cell's are added to
+ * @param v_sum_y The sum of the y velocities, which this cell's are added to
+ */
+static void create_cell(int i, int j, double v_magnitude, double * v_sum_x, double * v_sum_y) {
+	// calculate value outside loop to be used for double phi calculation
+	double placeholder = 2.0 * M_PI / RAND_MAX;
+
+	int k = ((i-1) * (y / split) + (j-1)) * num_part_per_dim * num_part_per_dim;
+	int middle_i = (i-1) * split + 1 + (split-1) / 2;
+	int middle_j = (j-1) * split + 1 + (split-1) / 2;
+	cells[middle_i][middle_j].start = k;
+	cells[middle_i][middle_j].count = num_part_per_dim * num_part_per_dim;
+	for (int a = 0; a < num_part_per_dim; a++) {
+		for (int b = 0; b < num_part_per_dim; b++) {
+			// set the particles x and y values within the current cell (on a lattice based on number of particles per cell, per dimension)
+			double part_x = 0.5 * (1.0 / num_part_per_dim) + ((double) a / num_part_per_dim);
+			double part_y = 0.5 * (1.0 / num_part_per_dim) + ((double) b / num_part_per_dim);
+
+			// generate random velocities for the particles, but make sure the overall magnitude is 1.0
+			// i.e. generate an angle between 0 and 2*PI then use cos and sin
+			double phi = (rng == RNG_RAND) ? (double) rand() * placeholder : 2.0 * M_PI * philox_uniform(seed, k);
+			double rand_vx = cos(phi);
+			double rand_vy = sin(phi);
+
+			// create the particle in the next slot of the particle arrays
+			parts.x[k] = part_x * cell_size * split;
+			parts.y[k] = part_y * cell_size * split;
+			parts.vx[k] = rand_vx * v_magnitude;
+			parts.vy[k] = rand_vy * v_magnitude;
+			parts.part_id[k] = k;
+
+			*v_sum_x += parts.vx[k];
+			*v_sum_y += parts.vy[k];
+			k++;
+		}
+	}
 }
 
 /**
  * @brief Set up the problem space, initialise the cells to contain particles,
  *        set the particles to exist on a regular lattice, set their velocities
  *        to be consistent with the initial temperature, but in random orientation.
+ *        With the counter-based generator, the columns are set up in parallel. The
+ *        momentum is summed per column then over the columns, in a fixed order, so
+ *        the initial state is identical for any number of threads.
  * 
  */
 void problem_setup() {
 	
 	// Create a grid of cell lists
-	cells = alloc_2d_cell_list_array(x+2, y+2);
-	num_particles = x * y * num_part_per_dim * num_part_per_dim;
+	cells = alloc_cells();
+	build_cell_order();
+
+	// the particles are created in the cells given on the command line (i.e. before they were split)
+	int lattice_x = x / split;
+	int lattice_y = y / split;
+	num_particles = lattice_x * lattice_y * num_part_per_dim * num_part_per_dim;
+	alloc_particle_data(&parts, num_particles);
 
-	double v_sum_x = 0.0;
-	double v_sum_y = 0.0;
+	// the sum of the velocities in each column
+	double * v_sum_x = (double *) calloc(lattice_x+2, sizeof(double));
+	double * v_sum_y = (double *) calloc(lattice_x+2, sizeof(double));
 
 	// set the normalisation magnitude using the ideal gas law (T = mv^2 / 3)
 	double v_magnitude = sqrt(3.0 * init_temp);
-	// calculate value outside loop to be used for double phi calculation
-	double placeholder = 2.0 * M_PI / RAND_MAX;
 
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			for (int a = 0; a < num_part_per_dim; a++) {
-				for (int b = 0; b < num_part_per_dim; b++) {
-					// set the particles x and y values within the current cell (on a lattice based on number of particles per cell, per dimension)
-					double part_x = 0.5 * (1.0 / num_part_per_dim) + ((double) a / num_part_per_dim);
-					double part_y = 0.5 * (1.0 / num_part_per_dim) + ((double) b / num_part_per_dim);
-
-					// generate random velocities for the particles, but make sure the overall magnitude is 1.0
-					// i.e. generate an angle between 0 and 2*PI then use cos and sin
-					double phi = (double) rand() * placeholder;
-					double rand_vx = cos(phi);
-					double rand_vy = sin(phi);
-
-					// create the particle and add it to the current cell list.			
-					struct particle_t * p = malloc(sizeof(struct particle_t));
-					p->x = part_x * cell_size;
-					p->y = part_y * cell_size;
-					p->vx = rand_vx * v_magnitude;
-					p->vy = rand_vy * v_magnitude;
-					add_particle(&(cells[i][j]), p);
-
-					v_sum_x += p->vx;
-					v_sum_y += p->vy;
-				}
-			}	
+	// particles are created in cell order, so each cell's particles are already contiguous
+	if (rng == RNG_RAND) {
+		for (int i = 1; i < lattice_x+1; i++) {
+			for (int j = 1; j < lattice_y+1; j++) {
+				create_cell(i, j, v_magnitude, &(v_sum_x[i]), &(v_sum_y[i]));
+			}
+		}
+	} else {
+		#pragma omp parallel for schedule(static)
+		for (int i = 1; i < lattice_x+1; i++) {
+			for (int j = 1; j < lattice_y+1; j++) {
+				create_cell(i, j, v_magnitude, &(v_sum_x[i]), &(v_sum_y[i]));
+			}
 		}
 	}
 
 	// Normalise data to make sure that the total momentum is 0.0 at the start
-	double v_avg_x = v_sum_x / num_particles;
-	double v_avg_y = v_sum_y / num_particles;
-
-	for (int i = 1; i < x+1; i++) {
-		for (int j = 1; j < y+1; j++) {
-			struct particle_t * p = cells[i][j].head;
-			while (p != NULL) {
-				p->vx -= v_avg_x;
-				p->vy -= v_avg_y;
-				p = p->next;
-			}
+	for (int i = 2; i < lattice_x+1; i++) {
+		v_sum_x[1] += v_sum_x[i];
+		v_sum_y[1] += v_sum_y[i];
+	}
+	double v_avg_x = v_sum_x[1] / num_particles;
+	double v_avg_y = v_sum_y[1] / num_particles;
+	free(v_sum_x);
+	free(v_sum_y);
+
+	#pragma omp parallel for schedule(static)
+	for (int k = 0; k < num_particles; k++) {
+		parts.vx[k] -= v_avg_x;
+		parts.vy[k] -= v_avg_y;
+	}
+
+	// the particles were created in row order of the unsplit cells (so the random velocities don't depend on the
+	// ordering or splitting), so put them into their own cells in the chosen order. Each (unsplit) cell's particles
+	// start in its middle cell, so they only have to move to neighbouring cells.
+	if ((cell_ordering != ORDER_ROW) || (split > 1)) {
+		int * part_cell = (int *) malloc(num_particles * sizeof(int));
+		int per_cell = num_part_per_dim * num_part_per_dim;
+		#pragma omp parallel for schedule(static)
+		for (int p = 0; p < num_particles; p++) {
+			int a = (int) (parts.x[p] / cell_size);
+			int b = (int) (parts.y[p] / cell_size);
+			parts.x[p] -= a * cell_size;
+			parts.y[p] -= b * cell_size;
+
+			int i = ((p / per_cell) / lattice_y) * split + 1 + a;
+			int j = ((p / per_cell) % lattice_y) * split + 1 + b;
+			part_cell[p] = i * (y+2*halo) + j;
 		}
+		#pragma omp parallel
+		sort_particles(part_cell);
+		free(part_cell);
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Free the particles and cells created by problem_setup
+ * 
+ */
+void problem_teardown() {
+	free_particle_data(&parts);
+	free_cells(cells);
+	cells = NULL;
+	free_cell_order();
+}
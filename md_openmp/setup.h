@@ -6,5 +6,6 @@
 void set_defaults();
 void setup();
 void problem_setup();
+void problem_teardown();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "data.h"
+#include "stencil.h"
+
+// the cells searched from each cell
+struct stencil_offset stencil[MAX_STENCIL];
+int num_stencil;
+int num_half_stencil;
+
+// whether each offset (within the halo) is in the stencil, indexed by (a+halo)*(2*halo+1) + (b+halo)
+static int reaches[MAX_STENCIL];
+
+/**
+ * @brief Check whether a cell can hold particles within the cut off plus skin of any particle in the
+ *        centre cell, i.e. whether the closest points of the two cells are close enough
+ *
+ * @param a The offset of the cell in x
+ * @param b The offset of the cell in y
+ * @return int Whether the cell is close enough
+ */
+static int within_reach(int a, int b) {
+	double r_list = r_cut_off + skin;
+	double gap_x = (abs(a) > 1) ? (abs(a) - 1) * cell_size : 0.0;
+	double gap_y = (abs(b) > 1) ? (abs(b) - 1) * cell_size : 0.0;
+	return (gap_x * gap_x + gap_y * gap_y) < (r_list * r_list);
+}
+
+/**
+ * @brief Add an offset to the stencil, if it is close enough
+ *
+ * @param a The offset in x
+ * @param b The offset in y
+ */
+static void add_offset(int a, int b) {
+	if (within_reach(a, b)) {
+		stencil[num_stencil].a = a;
+		stencil[num_stencil].b = b;
+		num_stencil++;
+		reaches[(a+halo) * (2*halo+1) + (b+halo)] = 1;
+	}
+}
+
+/**
+ * @brief Work out how many cells the cut off (plus skin) reaches, which sets the depth of the ghost cells,
+ *        and build the stencil of cells to search from each cell. Cells that are too far away to hold any
+ *        particles within the cut off are left out, so when the cells are smaller than the cut off the
+ *        searched area gets closer to the cut off circle. The half-shell stencil is the centre cell, the
+ *        cells above it and the cells in the following columns (so with a halo of 1, this is the usual
+ *        5 cell half-shell, followed by the other 4 cells).
+ *
+ */
+void build_stencil() {
+	halo = (int) ceil((r_cut_off + skin) / cell_size);
+	if (halo < 1) {
+		halo = 1;
+	}
+
+	// with a deeper halo, the grid must be wide enough that no cell sees the same cell twice
+	if ((halo > 1) && ((x < 2*halo+1) || (y < 2*halo+1))) {
+		fprintf(stderr, "Error: A halo of %d cells needs at least %d cells in each dimension.\n", halo, 2*halo+1);
+		exit(1);
+	}
+
+	num_stencil = 0;
+	add_offset(0, 0);
+	for (int b = 1; b <= halo; b++) {
+		add_offset(0, b);
+	}
+	for (int a = 1; a <= halo; a++) {
+		for (int b = -halo; b <= halo; b++) {
+			add_offset(a, b);
+		}
+	}
+	num_half_stencil = num_stencil;
+
+	for (int a = -halo; a <= -1; a++) {
+		for (int b = -halo; b <= halo; b++) {
+			add_offset(a, b);
+		}
+	}
+	for (int b = -halo; b <= -1; b++) {
+		add_offset(0, b);
+	}
+}
+
+/**
+ * @brief Check whether an offset is in the stencil
+ *
+ * @param a The offset in x (from -halo to halo)
+ * @param b The offset in y (from -halo to halo)
+ * @return int Whether the offset is in the stencil
+ */
+int stencil_reaches(int a, int b) {
+	return reaches[(a+halo) * (2*halo+1) + (b+halo)];
+}
@@ -0,0 +1,23 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+// the furthest the stencil can reach (in cells either side of the centre cell), and so the deepest the ghost cells can be
+#define MAX_HALO 3
+#define MAX_STENCIL ((2*MAX_HALO+1) * (2*MAX_HALO+1))
+
+// the offset from a cell to one of the cells searched from it
+struct stencil_offset {
+	int a; // the offset in x
+	int b; // the offset in y
+};
+
+// the cells searched from each cell (those that can hold particles within the cut off plus skin), with the
+// centre cell first, followed by the rest of the half-shell stencil and then the other half
+extern struct stencil_offset stencil[MAX_STENCIL];
+extern int num_stencil;
+extern int num_half_stencil;
+
+void build_stencil();
+int stencil_reaches(int a, int b);
+
+#endif